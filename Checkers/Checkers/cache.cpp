@@ -0,0 +1,539 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    constexpr char s_magic[4] = { 'C', 'K', 'A', 'C' };
+    constexpr uint32_t s_version = 2;
+
+    struct FileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t nEntries;
+        uint64_t nMoves;
+    };
+
+    // Boards of another size or other rules must never share an entry
+    uint64_t GetKey(const Position& position)
+    {
+        const uint64_t rules = static_cast<uint64_t>(position.size) * 4 + static_cast<uint64_t>(position.variant);
+        return CanonicalHash(position) ^ (rules * 0x9E3779B97F4A7C15ull);
+    }
+
+    // Replaces the destination in one step, readers never see a partial file
+    bool RenameOver(const string& from, const string& to)
+    {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+}
+
+//------------------------------------------------------------------------
+// MappedFile Implementation
+//------------------------------------------------------------------------
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const string& path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // An empty file can't be mapped but is still a valid file
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size > 0)
+    {
+        // The view keeps the mapping and the file alive after closing the handles
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0)
+    {
+        close(file);
+        return false;
+    }
+
+    // An empty file can't be mapped but is still a valid file
+    m_size = static_cast<size_t>(info.st_size);
+    if (m_size > 0)
+    {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file, 0);
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<const uint8_t*>(data);
+        }
+    }
+    close(file);
+#endif
+
+    if (m_size > 0 && !m_data)
+    {
+        m_size = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+const uint8_t* MappedFile::Data() const
+{
+    return m_data;
+}
+
+size_t MappedFile::Size() const
+{
+    return m_size;
+}
+
+//------------------------------------------------------------------------
+// AnalysisCache Implementation - Public API
+//------------------------------------------------------------------------
+AnalysisCache::~AnalysisCache()
+{
+    if (!m_writer.joinable())
+    {
+        return;
+    }
+
+    // The writer stores whatever is still pending before it exits
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeUp.notify_one();
+    m_writer.join();
+}
+
+bool AnalysisCache::Open(const string& path)
+{
+    if (m_writer.joinable())
+    {
+        return false;
+    }
+
+    m_path = path;
+    if (!MapFile())
+    {
+        return false;
+    }
+
+    m_writer = thread(&AnalysisCache::RunWriter, this);
+    return true;
+}
+
+bool AnalysisCache::Lookup(const Position& position, AnalysisResult& result) const
+{
+    Position canonical;
+    const bool isMirrored = CanonicalPosition(position, canonical);
+
+    Record record;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (!FindRecord(GetKey(canonical), record))
+        {
+            return false;
+        }
+    }
+
+    if (record.entry.bestMove >= record.moves.size())
+    {
+        return false;
+    }
+
+    vector<Move> moves;
+    GenerateMoves(canonical, moves);
+
+    vector<MoveStats> stats;
+    stats.reserve(record.moves.size());
+    for (const auto& entry : record.moves)
+    {
+        Move stored;
+        stored.origin = entry.origin;
+        stored.nHops = entry.nHops;
+        stored.path = entry.path;
+
+        // Rebuilding the full moves also rejects entries of colliding positions
+        const auto it = find_if(moves.begin(), moves.end(), [&](const Move& move)
+            { return IsSameMove(move, stored); });
+        if (it == moves.end())
+        {
+            return false;
+        }
+
+        MoveStats move;
+        move.move = isMirrored ? MirrorMove(position.size, *it) : *it;
+        move.nVisits = entry.nVisits;
+        move.score = entry.score;
+        stats.push_back(move);
+    }
+
+    result.nPlayouts = record.entry.nPlayouts;
+    result.score = record.entry.score;
+    result.bestMove = stats[record.entry.bestMove].move;
+    result.moves = move(stats);
+    return true;
+}
+
+void AnalysisCache::Store(const Position& position, const AnalysisResult& result)
+{
+    if (!m_writer.joinable() || result.nPlayouts == 0 || result.moves.size() > UINT16_MAX)
+    {
+        return;
+    }
+
+    const auto best = find_if(result.moves.begin(), result.moves.end(), [&](const MoveStats& stats)
+        { return IsSameMove(stats.move, result.bestMove); });
+    if (best == result.moves.end())
+    {
+        return;
+    }
+
+    Position canonical;
+    const bool isMirrored = CanonicalPosition(position, canonical);
+
+    Record record;
+    record.entry = {};
+    record.entry.key = GetKey(canonical);
+    record.entry.nPlayouts = result.nPlayouts;
+    record.entry.score = result.score;
+    record.entry.nMoves = static_cast<uint16_t>(result.moves.size());
+    record.entry.bestMove = static_cast<uint16_t>(best - result.moves.begin());
+
+    record.moves.reserve(result.moves.size());
+    for (const auto& stats : result.moves)
+    {
+        const Move move = isMirrored ? MirrorMove(position.size, stats.move) : stats.move;
+
+        MoveEntry entry = {};
+        entry.score = stats.score;
+        entry.nVisits = stats.nVisits;
+        entry.origin = move.origin;
+        entry.nHops = move.nHops;
+        entry.path = move.path;
+        record.moves.push_back(entry);
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    Record known;
+    if (FindRecord(record.entry.key, known) && known.entry.nPlayouts >= record.entry.nPlayouts)
+    {
+        return;
+    }
+
+    m_pending[record.entry.key] = move(record);
+    if (m_pending.size() >= m_batchSize)
+    {
+        m_wakeUp.notify_one();
+    }
+}
+
+void AnalysisCache::Flush()
+{
+    if (!m_writer.joinable())
+    {
+        return;
+    }
+
+    unique_lock<mutex> lock(m_mutex);
+    m_isFlushRequested = true;
+    m_wakeUp.notify_one();
+    m_written.wait(lock, [this]() { return !m_isFlushRequested; });
+}
+
+//------------------------------------------------------------------------
+// AnalysisCache Implementation - Private API
+//------------------------------------------------------------------------
+bool AnalysisCache::MapFile()
+{
+    m_entries = nullptr;
+    m_nEntries = 0;
+    m_moves = nullptr;
+    m_nMoves = 0;
+
+    if (!m_file.Open(m_path))
+    {
+        // Nothing has been written yet
+        return !ifstream(m_path);
+    }
+
+    if (m_file.Size() == 0)
+    {
+        return true;
+    }
+
+    FileHeader header = {};
+    if (m_file.Size() >= sizeof(header))
+    {
+        memcpy(&header, m_file.Data(), sizeof(header));
+    }
+
+    // The counts are checked first so a damaged header can't overflow the size
+    if (memcmp(header.magic, s_magic, sizeof(s_magic)) != 0
+        || header.version != s_version
+        || header.nEntries > m_file.Size()
+        || header.nMoves > m_file.Size()
+        || m_file.Size() != sizeof(header) + header.nEntries * sizeof(Entry) + header.nMoves * sizeof(MoveEntry))
+    {
+        m_file.Close();
+        return false;
+    }
+
+    const Entry* const entries = reinterpret_cast<const Entry*>(m_file.Data() + sizeof(header));
+    const size_t nEntries = static_cast<size_t>(header.nEntries);
+    const size_t nMoves = static_cast<size_t>(header.nMoves);
+
+    // Lookups and merges trust the index, a damaged one rejects the file
+    for (size_t i = 0; i < nEntries; ++i)
+    {
+        const Entry& entry = entries[i];
+        if ((i > 0 && entries[i - 1].key >= entry.key)
+            || entry.firstMove > nMoves
+            || entry.nMoves > nMoves - entry.firstMove
+            || entry.bestMove >= entry.nMoves)
+        {
+            m_file.Close();
+            return false;
+        }
+    }
+
+    m_entries = entries;
+    m_nEntries = nEntries;
+    m_moves = reinterpret_cast<const MoveEntry*>(entries + nEntries);
+    m_nMoves = nMoves;
+    return true;
+}
+
+bool AnalysisCache::FindRecord(uint64_t key, Record& record) const
+{
+    // m_mutex is held by the caller, newer results shadow the file
+    for (const auto* results : { &m_pending, &m_writing })
+    {
+        const auto it = results->find(key);
+        if (it != results->end())
+        {
+            record = it->second;
+            return true;
+        }
+    }
+
+    const Entry* const end = m_entries + m_nEntries;
+    const Entry* const it = lower_bound(m_entries, end, key, [](const Entry& entry, uint64_t key)
+        { return entry.key < key; });
+    if (it == end || it->key != key)
+    {
+        return false;
+    }
+
+    record.entry = *it;
+    record.moves.assign(m_moves + it->firstMove, m_moves + it->firstMove + it->nMoves);
+    return true;
+}
+
+bool AnalysisCache::WriteRecords(const vector<Entry>& entries, const vector<MoveEntry>& moves, const string& path) const
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.nEntries = entries.size();
+    header.nMoves = moves.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+    file.write(reinterpret_cast<const char*>(moves.data()), moves.size() * sizeof(MoveEntry));
+    return static_cast<bool>(file.flush());
+}
+
+void AnalysisCache::MergeRecords(vector<Entry>& entries, vector<MoveEntry>& moves) const
+{
+    // Only the writer thread changes m_writing and the mapping, so both can
+    // be read here without holding the lock
+    vector<const Record*> updates;
+    updates.reserve(m_writing.size());
+    for (const auto& result : m_writing)
+    {
+        updates.push_back(&result.second);
+    }
+    sort(updates.begin(), updates.end(), [](const Record* a, const Record* b)
+        { return a->entry.key < b->entry.key; });
+
+    entries.clear();
+    entries.reserve(m_nEntries + updates.size());
+    moves.clear();
+    moves.reserve(m_nMoves);
+
+    // The moves of every entry are copied behind the ones already merged
+    const auto append = [&](Entry entry, const MoveEntry* first)
+    {
+        entry.firstMove = static_cast<uint32_t>(moves.size());
+        moves.insert(moves.end(), first, first + entry.nMoves);
+        entries.push_back(entry);
+    };
+    const auto appendFile = [&](size_t i)
+        { append(m_entries[i], m_moves + m_entries[i].firstMove); };
+    const auto appendUpdate = [&](size_t j)
+        { append(updates[j]->entry, updates[j]->moves.data()); };
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < m_nEntries || j < updates.size())
+    {
+        if (j == updates.size() || (i < m_nEntries && m_entries[i].key < updates[j]->entry.key))
+        {
+            appendFile(i++);
+        }
+        else if (i == m_nEntries || updates[j]->entry.key < m_entries[i].key)
+        {
+            appendUpdate(j++);
+        }
+        else
+        {
+            if (updates[j]->entry.nPlayouts >= m_entries[i].nPlayouts)
+            {
+                appendUpdate(j);
+            }
+            else
+            {
+                appendFile(i);
+            }
+            ++i;
+            ++j;
+        }
+    }
+}
+
+void AnalysisCache::RunWriter()
+{
+    unique_lock<mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wakeUp.wait(lock, [this]()
+            { return m_stop || m_isFlushRequested || m_pending.size() >= m_batchSize; });
+
+        if (!m_pending.empty())
+        {
+            m_writing.swap(m_pending);
+            lock.unlock();
+
+            // The search keeps reading the old file while the new one is written
+            const string tempPath = m_path + ".tmp";
+            vector<Entry> entries;
+            vector<MoveEntry> moves;
+            MergeRecords(entries, moves);
+            const bool isWritten = WriteRecords(entries, moves, tempPath);
+
+            lock.lock();
+            if (isWritten)
+            {
+                // Windows can't replace a file that is still mapped
+                m_file.Close();
+                m_entries = nullptr;
+                m_nEntries = 0;
+                m_moves = nullptr;
+                m_nMoves = 0;
+
+                const bool isRenamed = RenameOver(tempPath, m_path);
+                if (!MapFile() || !isRenamed)
+                {
+                    cerr << "Unable to update analysis cache " << m_path << endl;
+                }
+            }
+            else
+            {
+                cerr << "Unable to write analysis cache " << tempPath << endl;
+            }
+
+            // Results that failed to write are dropped rather than retried forever
+            m_writing.clear();
+        }
+
+        if (m_pending.empty())
+        {
+            m_isFlushRequested = false;
+            m_written.notify_all();
+
+            if (m_stop)
+            {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "rules.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Read-only memory map of a whole file, pages are only read once touched
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const string& path);
+    void Close();
+
+    const uint8_t* Data() const;
+    size_t Size() const;
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Search statistics of a single move of the analysed position
+struct MoveStats
+{
+    Move move;
+    uint32_t nVisits = 0;
+
+    // Sum of the playout results for the side to move, s_winScore per win
+    uint64_t score = 0;
+};
+
+struct AnalysisResult
+{
+    // Playouts behind the result, i.e. the depth the search has reached
+    uint32_t nPlayouts = 0;
+
+    // Expected score of the best move for the side to move, out of s_winScore
+    uint32_t score = 0;
+    Move bestMove;
+
+    // Every visited move, a search seeded with them continues where the
+    // stored one stopped
+    vector<MoveStats> moves;
+};
+
+// Search results that outlive the session. Entries are keyed by the canonical
+// hash, so a position and its colour mirror share a single entry. The file
+// is mapped at startup, only its index is checked up front and only the
+// move records a lookup touches are read. New results are merged into it
+// in batches by a background thread.
+class AnalysisCache
+{
+public:
+    explicit AnalysisCache(size_t batchSize = 64) :
+        m_batchSize(batchSize > 0 ? batchSize : 1),
+        m_entries(nullptr),
+        m_nEntries(0),
+        m_moves(nullptr),
+        m_nMoves(0),
+        m_isFlushRequested(false),
+        m_stop(false)
+    {}
+
+    ~AnalysisCache();
+
+    // A missing file is an empty cache, it is created by the first write
+    bool Open(const string& path);
+
+    bool Lookup(const Position& position, AnalysisResult& result) const;
+
+    // Only the deepest result of a position is kept
+    void Store(const Position& position, const AnalysisResult& result);
+
+    // Blocks until every stored result is on disk
+    void Flush();
+
+private:
+    // The file is a header, the entries sorted by key and then the move
+    // records of all entries. Moves are stored in canonical form.
+    struct Entry
+    {
+        uint64_t key;
+        uint32_t nPlayouts;
+        uint32_t score;
+        uint32_t firstMove;
+        uint16_t nMoves;
+        uint16_t bestMove;
+    };
+
+    struct MoveEntry
+    {
+        uint64_t score;
+        uint32_t nVisits;
+        int8_t origin;
+        int8_t nHops;
+        array<int8_t, s_maxHops> path;
+        array<int8_t, 6> reserved;
+    };
+
+    static_assert(sizeof(Entry) == 24, "Entry is part of the file format");
+    static_assert(sizeof(MoveEntry) == 32, "MoveEntry is part of the file format");
+
+    // Entry with its moves, as held in memory until it is written
+    struct Record
+    {
+        Entry entry;
+        vector<MoveEntry> moves;
+    };
+
+    bool MapFile();
+    bool FindRecord(uint64_t key, Record& record) const;
+    bool WriteRecords(const vector<Entry>& entries, const vector<MoveEntry>& moves, const string& path) const;
+    void MergeRecords(vector<Entry>& entries, vector<MoveEntry>& moves) const;
+    void RunWriter();
+
+    const size_t m_batchSize;
+    string m_path;
+
+    // Replaced by the writer only, under m_mutex
+    MappedFile m_file;
+    const Entry* m_entries;
+    size_t m_nEntries;
+    const MoveEntry* m_moves;
+    size_t m_nMoves;
+
+    // Results not in the mapped file yet, m_writing is being merged into it
+    mutable mutex m_mutex;
+    condition_variable m_wakeUp;
+    condition_variable m_written;
+    unordered_map<uint64_t, Record> m_pending;
+    unordered_map<uint64_t, Record> m_writing;
+    bool m_isFlushRequested;
+    bool m_stop;
+    thread m_writer;
+};
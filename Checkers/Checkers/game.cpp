@@ -1,24 +1,26 @@
 #include "game.h"
+#include "rules.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 using namespace std;
 
-constexpr auto s_oPiece = 'o';
-constexpr auto s_oKingPiece = 'O';
-constexpr auto s_xPiece = 'x';
-constexpr auto s_xKingPiece = 'X';
-
-constexpr auto s_emptyPiece = '.';
-
 //------------------------------------------------------------------------
 // Game Implementation - Public API
 //------------------------------------------------------------------------
 void Game::InitializeBoard()
 {
+    // International draughts starts from 4 rows of men on each side, the
+    // standard rules keep the house layout
+    const bool isInternational = m_variant == RuleVariant::International;
+    const int nXRows = isInternational ? 4 : 1;
+    const int nORows = isInternational ? 4 : 3;
+    const char oPiece = isInternational ? s_oPiece : s_oKingPiece;
+
     // Initialize x pieces
-    for (int row = 0; row < 1; ++row)
+    for (int row = 0; row < nXRows; ++row)
     {
         const int startPoint = row % 2 == 0 ? 1 : 0;
         for (int col = startPoint; col < m_size; col += 2)
@@ -28,7 +30,7 @@ void Game::InitializeBoard()
     }
 
     // Initialize empty rows
-    for (int row = 1; row < m_size - 3; ++row)
+    for (int row = nXRows; row < m_size - nORows; ++row)
     {
         const int startPoint = row % 2 == 0 ? 1 : 0;
         for (int col = startPoint; col < m_size; col += 2)
@@ -38,25 +40,35 @@ void Game::InitializeBoard()
     }
 
     // Initialize o pieces
-    for (int row = m_size - 3; row < m_size; ++row)
+    for (int row = m_size - nORows; row < m_size; ++row)
     {
         const int startPoint = row % 2 == 0 ? 1 : 0;
         for (int col = startPoint; col < m_size; col += 2)
         {
-            m_board[row][col] = s_oKingPiece;
+            m_board[row][col] = oPiece;
         }
     }
+
+    m_hasPosition = PositionFromBoard(m_board, m_curTurn, m_variant, m_position);
+    ResetPositionHistory();
 }
 
 bool Game::InitializeCustomBoard(Board&& board)
 {
     // We allow the function to accept a custom state
     // to easily test and simulate certain board states
+    // Boards the rules core can't play, e.g. with pieces on light squares,
+    // are rejected as well
+    Position position;
     if (board.size() == m_size
         && board.size() > 0
-        && board.front().size() == m_size)
+        && board.front().size() == m_size
+        && PositionFromBoard(board, m_curTurn, m_variant, position))
     {
         m_board = move(board);
+        m_position = position;
+        m_hasPosition = true;
+        ResetPositionHistory();
         return true;
     }
 
@@ -65,100 +77,80 @@ bool Game::InitializeCustomBoard(Board&& board)
 
 bool Game::CheckWinCondition()
 {
-    // Case 1: One side has no more pieces remaining
-    int nOPieces = 0;
-    int nXPieces = 0;
-    for (const auto& row : m_board)
+    // Nothing can be decided without a position, no move can be made either
+    if (!m_hasPosition)
     {
-        for (auto c : row)
-        {
-            if (c == s_oPiece || c == s_oKingPiece)
-                nOPieces++;
-            else if (c == s_xPiece || c == s_xKingPiece)
-                nXPieces++;
-        }
+        return false;
     }
 
-    if (nOPieces == 0)
+    // Case 1 and 2: One side has no more pieces or no more valid moves
+    if (GetTerminalWinner(m_position, m_winner))
     {
-        m_winner = PlayerSide::XPlayer;
         return true;
     }
-    else if (nXPieces == 0)
+
+    // Case 3: Repeated positions or too many moves without progress
+    if (IsDraw())
     {
-        m_winner = PlayerSide::OPlayer;
+        m_winner = PlayerSide::None;
         return true;
     }
 
-    // Case 2: No more valid moves for O side
-    bool hasValidMovesForO = false;
-    if (!hasValidMovesForO)
-    {
-        for (size_t i = 0; i < m_board.size(); ++i)
-        {
-            for (size_t j = 0; j < m_board[i].size(); ++j)
-            {
-                const char c = m_board[i][j];
-                if (c != s_oPiece && c != s_oKingPiece)
-                {
-                    continue;
-                }
-
-                Coordinates origin;
-                origin.row = i;
-                origin.col = j;
-                if (GetPossibleMoves(origin).size() > 0)
-                {
-                    hasValidMovesForO = true;
-                    break;
-                }
-            }
-
-            if (hasValidMovesForO)
-                break;
-        }
-    }
-    if (!hasValidMovesForO)
+    return false;
+}
+
+void Game::SetDrawPlyLimit(int nPlies)
+{
+    m_drawPlyLimit = nPlies;
+}
+
+bool Game::Snapshot(GameSnapshot& snapshot) const
+{
+    if (!m_hasPosition)
     {
-        m_winner = PlayerSide::XPlayer;
-        return true;
+        return false;
     }
 
-    // Case 2: No more valid moves for X side
-    bool hasValidMovesForX = false;
-    if (!hasValidMovesForX)
+    snapshot.position = m_position;
+    snapshot.position.sideToMove = m_curTurn;
+    snapshot.winner = m_winner;
+    snapshot.isRunning = m_isRunning;
+    snapshot.nQuietPlies = static_cast<int16_t>(m_nQuietPlies);
+    return true;
+}
+
+bool Game::Restore(const GameSnapshot& snapshot)
+{
+    if (!IsSupportedBoardSize(snapshot.position.size)
+        || snapshot.position.size != m_size
+        || snapshot.position.variant != m_variant)
     {
-        for (size_t i = 0; i < m_board.size(); ++i)
-        {
-            for (size_t j = 0; j < m_board[i].size(); ++j)
-            {
-                const char c = m_board[i][j];
-                if (c != s_xPiece && c != s_xKingPiece)
-                {
-                    continue;
-                }
-
-                Coordinates origin;
-                origin.row = i;
-                origin.col = j;
-                if (GetPossibleMoves(origin).size() > 0)
-                {
-                    hasValidMovesForX = true;
-                    break;
-                }
-            }
-
-            if (hasValidMovesForX)
-                break;
-        }
+        return false;
     }
-    if (!hasValidMovesForX)
+
+    m_position = snapshot.position;
+    m_hasPosition = true;
+    m_curTurn = snapshot.position.sideToMove;
+    m_winner = snapshot.winner;
+    m_isRunning = snapshot.isRunning;
+    UpdateBoard();
+
+    ResetPositionHistory();
+    m_nQuietPlies = snapshot.nQuietPlies;
+    return true;
+}
+
+Game Game::Fork() const
+{
+    GameSnapshot snapshot;
+    if (!Snapshot(snapshot))
     {
-        m_winner = PlayerSide::OPlayer;
-        return true;
+        return *this;
     }
 
-    return false;
+    Game game(snapshot);
+    game.SetDrawPlyLimit(m_drawPlyLimit);
+    return game;
 }
 
 const Board& Game::GetBoard() const
@@ -181,6 +173,29 @@ PlayerSide Game::GetWinner() const
     return m_winner;
 }
 
+RuleVariant Game::GetRuleVariant() const
+{
+    return m_variant;
+}
+
+bool Game::IsDraw() const
+{
+    // A limit of 0 disables the move count rule
+    if (m_drawPlyLimit > 0 && m_nQuietPlies >= m_drawPlyLimit)
+    {
+        return true;
+    }
+
+    if (m_positionHistory.empty())
+    {
+        return false;
+    }
+
+    const uint64_t current = m_positionHistory.back();
+    const auto nRepetitions = count(m_positionHistory.begin(), m_positionHistory.end(), current);
+    return nRepetitions >= s_drawRepetitions;
+}
+
 Coordinates Game::GetCoordinates(const string& input) const
 {
     Coordinates coord;
@@ -230,58 +245,25 @@ bool Game::ProcessInput(const vector<string>& inputs)
     const char pieceSymbol = Get(piece);
 
     // Validate piece
-    switch (m_curTurn)
-    {
-    case PlayerSide::OPlayer:
+    if (GetPieceOwner(pieceSymbol) != m_curTurn)
     {
-        if (pieceSymbol != s_oPiece && pieceSymbol != s_oKingPiece)
-        {
-            cout << "Not a valid o piece" << endl;
-            return false;
-        }
-        break;
-    }
-    case PlayerSide::XPlayer:
-    {
-        if (pieceSymbol != s_xPiece && pieceSymbol != s_xKingPiece)
-        {
-            cout << "Not a valid x piece" << endl;
-            return false;
-        }
-        break;
-    }
+        cout << "Not a valid " << (m_curTurn == PlayerSide::OPlayer ? s_oPiece : s_xPiece) << " piece" << endl;
+        return false;
     }
 
     // Move piece
-    for (size_t i = 1; i < inputs.size(); ++i)
+    Move move;
+    if (!FindMove(inputs, move))
     {
-        const auto& move = inputs[i];
-        Coordinates dest = GetCoordinates(move);
-        if (Get(dest) != s_emptyPiece)
-        {
-            cout << "Invalid destination" << endl;
-            return false;
-        }
-
-        if (!MovePiece(piece, dest))
-        {
-            cout << "Unable to move from ";
-            cout << inputs[i-1] << " to ";
-            cout << move << endl;
-
-            return false;
-        }
-
-        if (IsCapture(piece, dest))
-        {
-            piece = dest;
-        }
-        else
-        {
-            break;
-        }
+        return false;
     }
 
+    const bool isIrreversible = IsIrreversible(m_position, move);
+    m_position.sideToMove = m_curTurn;
+    ApplyMove(m_position, move);
+    UpdateBoard();
+    RecordPosition(m_position.sideToMove, isIrreversible);
+
     m_isRunning = !CheckWinCondition();
     if (m_isRunning)
     {
@@ -299,169 +281,129 @@ bool Game::ProcessInput(const vector<string>& inputs)
 //------------------------------------------------------------------------
 // Game Implementation - Private API
 //------------------------------------------------------------------------
-bool Game::IsCapture(const Coordinates& origin, const Coordinates& dest) const
+char Game::Get(const Coordinates& coord) const
 {
-    // 1 step means a move, 2 steps means a capture
-    const int nSteps = abs(dest.row - origin.row);
-    if (nSteps == 2)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    if (coord.IsValid())
+        return m_board[coord.row][coord.col];
 }
 
-bool Game::MovePiece(const Coordinates& origin, const Coordinates& dest)
+int Game::GetSquare(const Coordinates& coord) const
 {
-    if (!CanMove(origin, dest))
+    // Light squares are never part of a move, and would otherwise share the
+    // index of the dark square next to them
+    if ((coord.row + coord.col) % 2 == 0)
     {
-        return false;
+        return s_invalidSquare;
     }
 
-    if (IsCapture(origin, dest))
-    {
-        return HandleCapture(origin, dest);
-    }
-    else
-    {
-        return HandleMove(origin, dest);
-    }
+    return (coord.row * m_size + coord.col) / 2;
 }
 
-void Game::Set(const Coordinates& coord, char c)
-{
-    m_board[coord.row][coord.col] = c;
-}
-
-char Game::Get(const Coordinates& coord) const
+void Game::NextTurn()
 {
-    if (coord.IsValid())
-        return m_board[coord.row][coord.col];
+    m_curTurn = Opponent(m_curTurn);
 }
 
-void Game::NextTurn()
+void Game::UpdateBoard()
 {
-    switch (m_curTurn)
+    // Rewrite the playable squares in place, rows keep their storage
+    const auto& tables = GetDiagonalTables(m_size);
+    for (int square = 0; square < tables.nSquares; ++square)
     {
-        case PlayerSide::OPlayer:
-        {
-            m_curTurn = PlayerSide::XPlayer;
-            break;
-        }
-        case PlayerSide::XPlayer:
-        {
-            m_curTurn = PlayerSide::OPlayer;
-            break;
-        }
+        m_board[tables.row[square]][tables.col[square]] = GetPiece(m_position, square);
     }
 }
 
-bool Game::HandleMove(const Coordinates& origin, const Coordinates& dest)
+void Game::ResetPositionHistory()
 {
-    Set(dest, Get(origin));
-    Set(origin, s_emptyPiece);
+    m_nQuietPlies = 0;
+    m_positionHistory.clear();
+    RecordPosition(m_curTurn, true);
+}
 
-    // Handle Promotion
-    if (dest.row == 0 && Get(dest) == s_oPiece)
+void Game::RecordPosition(PlayerSide sideToMove, bool isIrreversible)
+{
+    if (isIrreversible)
     {
-        Set(dest, s_oKingPiece);
+        m_nQuietPlies = 0;
+        m_positionHistory.clear();
     }
-    if (dest.row == m_size - 1 && Get(dest) == s_xPiece)
+    else
     {
-        Set(dest, s_xKingPiece);
+        m_nQuietPlies++;
     }
 
-    return true;
+    // Boards the rules core can't represent only use the move count rule
+    if (m_hasPosition)
+    {
+        Position position = m_position;
+        position.sideToMove = sideToMove;
+        m_positionHistory.push_back(HashPosition(position));
+    }
 }
 
-bool Game::HandleCapture(const Coordinates& origin, const Coordinates& dest)
+bool Game::FindMove(const vector<string>& inputs, Move& move) const
 {
-    Coordinates pos;
-
-    // Right direction
-    if (dest.col > origin.col)
-    {
-        pos.col = dest.col - 1;
-    }
-    else // Left direction
+    if (!m_hasPosition)
     {
-        pos.col = dest.col + 1;
+        cout << "Board is not supported by the rules" << endl;
+        return false;
     }
 
-    switch (Get(origin))
+    Position position = m_position;
+    position.sideToMove = m_curTurn;
+    vector<Move> moves;
+    GenerateMoves(position, moves);
+
+    const Coordinates origin = GetCoordinates(inputs[0]);
+    const int originSquare = GetSquare(origin);
+
+    // Follow the turn one landing square at a time, every stop of a capture
+    // chain is a legal turn of its own
+    const Move* found = nullptr;
+    for (size_t i = 1; i < inputs.size(); ++i)
     {
-        case s_oPiece:
-        {
-            pos.row = dest.row + 1;
-            const char c = Get(pos);
-            if (c != s_xPiece && c != s_xKingPiece)
-                return false;
-            else
-                Set(pos, s_emptyPiece);
-            break;
-        }
-        case s_xPiece:
+        const Coordinates dest = GetCoordinates(inputs[i]);
+        const int destSquare = GetSquare(dest);
+
+        // A capture chain may end where it started
+        if (Get(dest) != s_emptyPiece && destSquare != originSquare)
         {
-            pos.row = dest.row - 1;
-            const char c = Get(pos);
-            if (c != s_oPiece && c != s_oKingPiece)
-                return false;
-            else
-                Set(pos, s_emptyPiece);
-            break;
+            cout << "Invalid destination" << endl;
+            return false;
         }
-        case s_oKingPiece:
+
+        const int nHops = static_cast<int>(i);
+        const auto it = find_if(moves.begin(), moves.end(), [&](const Move& candidate)
         {
-            pos.row = dest.row > origin.row ? dest.row - 1 : dest.row + 1;
-            const char c = Get(pos);
-            if (c != s_xPiece && c != s_xKingPiece)
-                return false;
-            else
-                Set(pos, s_emptyPiece);
-            break;
-        }
-        case s_xKingPiece:
+            return candidate.origin == originSquare
+                && candidate.nHops == nHops
+                && candidate.path[nHops - 1] == destSquare
+                && (!found || equal(found->path.begin(), found->path.begin() + nHops - 1, candidate.path.begin()));
+        });
+
+        if (it == moves.end())
         {
-            pos.row = dest.row > origin.row ? dest.row - 1 : dest.row + 1;
-            const char c = Get(pos);
-            if (c != s_oPiece && c != s_oKingPiece)
-                return false;
-            else
-                Set(pos, s_emptyPiece);
-            break;
+            cout << "Unable to move from ";
+            cout << inputs[i-1] << " to ";
+            cout << inputs[i] << endl;
+
+            return false;
         }
-    }
 
-    return HandleMove(origin, dest);
-}
+        found = &*it;
 
-bool Game::CanMove(const Coordinates& origin, const Coordinates& dest) const
-{
-    if (!IsReachable(origin, dest, 2) || Get(dest) != s_emptyPiece)
-    {
-        return false;
+        // A simple move ends the turn, squares typed after it make the whole
+        // turn illegal just like in the archive validator
+        if (!found->captured && i + 1 < inputs.size())
+        {
+            cout << "Unable to move past " << inputs[i] << endl;
+            return false;
+        }
     }
 
-    const char c = Get(origin);
-    // As king, the piece can move forwards and backwards
-    if (c == s_xKingPiece || c == s_oKingPiece)
-    {
-        return true;
-    }
-    else if (c == s_oPiece)// As regular piece
-    {
-        return dest.row < origin.row;
-    }
-    else if (c == s_xPiece)
-    {
-        return dest.row > origin.row;
-    }
-    else
-    {
-        return false;
-    }
+    move = *found;
+    return true;
 }
 
 bool Game::ValidateInputs(const vector<string>& inputs) const
@@ -517,141 +459,3 @@ bool Game::ValidateValues(const string& input) const
 
     return true;
 }
-
-bool Game::ValidateCoordinates(const Coordinates& coord) const
-{
-    if (coord.col < 0 || coord.col >= m_size)
-    {
-        return false;
-    }
-
-    if (coord.row < 0 || coord.row >= m_size)
-    {
-        return false;
-    }
-
-    return true;
-}
-
-inline bool Game::IsReachable(const Coordinates& a, const Coordinates& b, int steps) const
-{
-    const auto rowDiff = abs(a.row - b.row);
-    const auto colDiff = abs(a.col - b.col);
-    return rowDiff <= steps && colDiff <= steps && rowDiff == colDiff;
-}
-
-vector<Coordinates> Game::GetPossibleMoves(const Coordinates& origin) const
-{
-    vector<Coordinates> moves;
-
-    // Move and capture regular pieces
-    Coordinates leftMove, rightMove, leftCapture, rightCapture;
-
-    // Move and capture for king pieces
-    Coordinates left2Move, right2Move, left2Capture, right2Capture;
-
-    switch (Get(origin))
-    {
-        case s_oPiece:
-        {
-            // Move left
-            leftMove.col = origin.col - 1;
-            leftMove.row = origin.row - 1;
-
-            // Move right
-            rightMove.col = origin.col + 1;
-            rightMove.row = origin.row - 1;
-
-            // Capture left
-            leftCapture.col = origin.col - 2;
-            leftCapture.row = origin.row - 2;
-
-            // Capture right
-            rightCapture.col = origin.col + 2;
-            rightCapture.row = origin.row - 2;
-
-            break;
-        }
-        case s_xPiece:
-        {
-            // Move left
-            leftMove.col = origin.col + 1;
-            leftMove.row = origin.row + 1;
-
-            // Move right
-            rightMove.col = origin.col - 1;
-            rightMove.row = origin.row + 1;
-
-            // Capture left
-            leftCapture.col = origin.col + 2;
-            leftCapture.row = origin.row + 2;
-
-            // Capture right
-            rightCapture.col = origin.col - 2;
-            rightCapture.row = origin.row + 2;
-
-            break;
-        }
-        case s_oKingPiece:
-        case s_xKingPiece:
-        {
-            // Move left
-            leftMove.col = origin.col - 1;
-            leftMove.row = origin.row - 1;
-
-            // Move backwards left
-            left2Move.col = origin.col + 1;
-            left2Move.row = origin.row + 1;
-
-            // Move right
-            rightMove.col = origin.col + 1;
-            rightMove.row = origin.row - 1;
-
-            // Move backwards right
-            right2Move.col = origin.col - 1;
-            right2Move.row = origin.row + 1;
-
-            // Capture left
-            leftCapture.col = origin.col - 2;
-            leftCapture.row = origin.row - 2;
-
-            left2Capture.col = origin.col + 2;
-            left2Capture.row = origin.row + 2;
-
-            // Capture right
-            rightCapture.col = origin.col + 2;
-            rightCapture.row = origin.row - 2;
-
-            right2Capture.col = origin.col - 2;
-            right2Capture.row = origin.row + 2;
-
-            break;
-        }
-    }
-
-    if (leftMove.IsValid() && ValidateCoordinates(leftMove) && CanMove(origin, leftMove))
-        moves.push_back(move(leftMove));
-
-    if (rightMove.IsValid() && ValidateCoordinates(rightMove) && CanMove(origin, rightMove))
-        moves.push_back(move(rightMove));
-
-    if (leftCapture.IsValid() && ValidateCoordinates(leftCapture) && CanMove(origin, leftCapture))
-        moves.push_back(move(leftCapture));
-
-    if (rightCapture.IsValid() && ValidateCoordinates(rightCapture) && CanMove(origin, rightCapture))
-        moves.push_back(move(rightCapture));
-
-    if (left2Move.IsValid() && ValidateCoordinates(left2Move) && CanMove(origin, left2Move))
-        moves.push_back(move(left2Move));
-
-    if (right2Move.IsValid() && ValidateCoordinates(right2Move) && CanMove(origin, right2Move))
-        moves.push_back(move(right2Move));
-
-    if (left2Capture.IsValid() && ValidateCoordinates(left2Capture) && CanMove(origin, left2Capture))
-        moves.push_back(move(left2Capture));
-
-    if (right2Capture.IsValid() && ValidateCoordinates(right2Capture) && CanMove(origin, right2Capture))
-        moves.push_back(move(right2Capture));
-
-    return moves;
-}
@@ -1,19 +1,14 @@
 #pragma once
 
+#include "rules.h"
+
 #include <iostream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 using namespace std;
 
-using Board = vector<string>;
-
-enum class PlayerSide
-{
-    OPlayer,
-    XPlayer,
-};
-
 struct Coordinates
 {
     bool IsValid() const
@@ -25,53 +20,97 @@ struct Coordinates
     int col = -1;
 };
 
+// Compact copy of the game state, a few dozen bytes that can be copied
+// around freely to branch a game or to hand it over to another thread.
+// Repetition history is not part of the snapshot.
+struct GameSnapshot
+{
+    Position position;
+    PlayerSide winner = PlayerSide::OPlayer;
+    bool isRunning = true;
+    int16_t nQuietPlies = 0;
+};
+
+static_assert(is_trivially_copyable<GameSnapshot>::value, "GameSnapshot must stay trivially copyable");
+
 class Game
 {
 public:
-    Game(int size) :
+    // Boards must have an even size of at most s_maxBoardSize to be playable
+    Game(int size, RuleVariant variant = RuleVariant::Standard) :
         m_size(size),
+        m_variant(variant),
         m_isRunning(true),
         m_curTurn(PlayerSide::OPlayer),
         m_winner(PlayerSide::OPlayer),
+        m_drawPlyLimit(s_defaultDrawPlyLimit),
+        m_nQuietPlies(0),
+        m_hasPosition(false),
         m_board(size, string(size, ' '))
     {}
 
+    // A snapshot that can't be restored gives a stopped game without a
+    // position, Snapshot then fails on it
+    explicit Game(const GameSnapshot& snapshot) :
+        Game(IsSupportedBoardSize(snapshot.position.size) ? snapshot.position.size : 0, snapshot.position.variant)
+    {
+        if (!Restore(snapshot))
+        {
+            m_isRunning = false;
+            m_winner = PlayerSide::None;
+        }
+    }
+
     void InitializeBoard();
     bool InitializeCustomBoard(Board&& board);
     bool CheckWinCondition();
     bool ProcessInput(const vector<string>& inputs);
+    void SetDrawPlyLimit(int nPlies);
+
+    // Snapshots are only available for boards the rules core can represent
+    bool Snapshot(GameSnapshot& snapshot) const;
+    bool Restore(const GameSnapshot& snapshot);
+    Game Fork() const;
 
     const Board& GetBoard() const;
     bool IsGameRunning() const;
     PlayerSide GetCurrentPlayerTurn() const;
     PlayerSide GetWinner() const;
+    RuleVariant GetRuleVariant() const;
+    bool IsDraw() const;
     Coordinates GetCoordinates(const string& input) const;
     void PrintBoard() const;
 
 private:
-    bool IsCapture(const Coordinates& origin, const Coordinates& dest) const;
-    bool MovePiece(const Coordinates& origin, const Coordinates& dest);
-    void Set(const Coordinates& coord, char c);
     char Get(const Coordinates& coord) const;
+    int GetSquare(const Coordinates& coord) const;
     void NextTurn();
-    bool HandleMove(const Coordinates& origin, const Coordinates& dest);
-    bool HandleCapture(const Coordinates& origin, const Coordinates& dest);
-
-    vector<Coordinates> GetPossibleMoves(const Coordinates& origin) const;
+    void UpdateBoard();
+    void ResetPositionHistory();
+    void RecordPosition(PlayerSide sideToMove, bool isIrreversible);
 
     // Validation helper functions
-    bool CanMove(const Coordinates& origin, const Coordinates& dest) const;
+    bool FindMove(const vector<string>& inputs, Move& move) const;
     bool ValidateInputs(const vector<string>& inputs) const;
     bool ValidateFormat(const string& input) const;
     bool ValidateValues(const string& input) const;
-    bool ValidateCoordinates(const Coordinates& coord) const;
-    inline bool IsReachable(const Coordinates& a, const Coordinates& b, int steps) const;
 
     const int m_size;
+    const RuleVariant m_variant;
     bool m_isRunning;
     PlayerSide m_curTurn;
     PlayerSide m_winner;
 
+    // Draw detection, only positions since the last capture or regular piece
+    // move are kept since earlier ones can never be repeated
+    int m_drawPlyLimit;
+    int m_nQuietPlies;
+    vector<uint64_t> m_positionHistory;
+
+    // Rules state of the board, m_board is rewritten from it after every move
+    bool m_hasPosition;
+    Position m_position;
+
     // Internal representation of checkers board
     Board m_board;
 };
@@ -1,13 +1,21 @@
 // Checkers.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include "cache.h"
 #include "game.h"
+#include "mcts.h"
+#include "network.h"
+#include "validator.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <thread>
 
 constexpr auto s_promptPrefix = "player ";
 constexpr auto s_promptSuffix = "> ";
+constexpr auto s_defaultCachePath = "analysis.cache";
 
 namespace
 {
@@ -38,12 +46,289 @@ namespace
         result.push_back(str.substr(start));
         return result;
     }
+
+    struct Options
+    {
+        bool mctsPlayer = false;
+        bool ponder = false;
+        bool mctsBench = false;
+        bool networkBench = false;
+        bool international = false;
+        bool analyze = false;
+        string cachePath;
+        string networkPath;
+        string validatePath;
+        int drawPlyLimit = s_defaultDrawPlyLimit;
+        MctsConfig mctsConfig;
+        BatchConfig batchConfig;
+    };
+
+    Options ParseOptions(int argc, char* argv[])
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--mcts") == 0)
+            {
+                options.mctsPlayer = true;
+            }
+            else if (strcmp(argv[i], "--ponder") == 0)
+            {
+                options.ponder = true;
+            }
+            else if (strcmp(argv[i], "--mcts-bench") == 0)
+            {
+                options.mctsBench = true;
+            }
+            else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            {
+                options.mctsConfig.nThreads = atoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--playouts") == 0 && i + 1 < argc)
+            {
+                options.mctsConfig.nPlayouts = strtoull(argv[++i], nullptr, 10);
+            }
+            else if (strcmp(argv[i], "--validate") == 0 && i + 1 < argc)
+            {
+                options.validatePath = argv[++i];
+            }
+            else if (strcmp(argv[i], "--draw-limit") == 0 && i + 1 < argc)
+            {
+                options.drawPlyLimit = atoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--network") == 0 && i + 1 < argc)
+            {
+                options.networkPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "--network-bench") == 0)
+            {
+                options.networkBench = true;
+            }
+            else if (strcmp(argv[i], "--analyze") == 0)
+            {
+                options.analyze = true;
+            }
+            else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            {
+                options.cachePath = argv[++i];
+            }
+            else if (strcmp(argv[i], "--international") == 0)
+            {
+                options.international = true;
+            }
+            else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            {
+                options.batchConfig.maxBatchSize = atoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--batch-wait") == 0 && i + 1 < argc)
+            {
+                options.batchConfig.maxWait = chrono::microseconds(atoi(argv[++i]));
+            }
+        }
+
+        return options;
+    }
+
+    bool GetPosition(const Game& game, Position& position)
+    {
+        GameSnapshot snapshot;
+        if (!game.Snapshot(snapshot))
+        {
+            return false;
+        }
+
+        position = snapshot.position;
+        return true;
+    }
+
+    // Reports playout throughput and how it scales with the number of threads
+    void RunMctsBenchmark(const Game& game, MctsConfig config)
+    {
+        Position position;
+        if (!GetPosition(game, position))
+        {
+            cout << "Board is not supported by the search engine" << endl;
+            return;
+        }
+
+        const int maxThreads = max(1, static_cast<int>(thread::hardware_concurrency()));
+        vector<int> threadCounts;
+        for (int nThreads = 1; nThreads < maxThreads; nThreads *= 2)
+        {
+            threadCounts.push_back(nThreads);
+        }
+        threadCounts.push_back(maxThreads);
+
+        double baseline = 0.0;
+        for (int nThreads : threadCounts)
+        {
+            config.nThreads = nThreads;
+            MctsPlayer player(config);
+
+            Move bestMove;
+            player.Search(position, bestMove);
+
+            const auto& stats = player.GetStats();
+            const double rate = stats.PlayoutsPerSecond();
+            if (baseline == 0.0)
+            {
+                baseline = rate;
+            }
+
+            cout << "threads: " << nThreads;
+            cout << " playouts: " << stats.nPlayouts;
+            cout << " nodes: " << stats.nNodes;
+            cout << " playouts/sec: " << static_cast<uint64_t>(rate);
+            cout << " speedup: " << (baseline > 0.0 ? rate / baseline : 0.0) << endl;
+        }
+    }
+
+    // Reports raw network throughput and search latency for growing batch sizes
+    void RunNetworkBenchmark(const Game& game, const Network& network, const Options& options)
+    {
+        Position position;
+        if (!GetPosition(game, position))
+        {
+            cout << "Board is not supported by the search engine" << endl;
+            return;
+        }
+
+        NetworkInput input;
+        EncodePosition(position, input);
+
+        constexpr int s_nRawPositions = 4096;
+        for (int batchSize = 1; batchSize <= 64; batchSize *= 2)
+        {
+            vector<uint8_t> inputs;
+            for (int i = 0; i < batchSize; ++i)
+            {
+                inputs.insert(inputs.end(), input.begin(), input.end());
+            }
+            vector<NetworkOutput> outputs(batchSize);
+
+            const auto start = chrono::steady_clock::now();
+            for (int i = 0; i < s_nRawPositions; i += batchSize)
+            {
+                network.Evaluate(inputs.data(), batchSize, outputs.data());
+            }
+            const double rawMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+            // Search threads are the only source of requests, so there must be
+            // at least as many of them as the batch can hold
+            BatchConfig batchConfig = options.batchConfig;
+            batchConfig.maxBatchSize = batchSize;
+            BatchEvaluator evaluator(network, batchConfig);
+
+            MctsConfig config = options.mctsConfig;
+            config.nThreads = max(config.nThreads, batchSize);
+            config.evaluator = &evaluator;
+            MctsPlayer player(config);
+
+            Move bestMove;
+            player.Search(position, bestMove);
+
+            const auto stats = evaluator.GetStats();
+            cout << "batch: " << batchSize;
+            cout << " raw us/position: " << rawMicros / s_nRawPositions;
+            cout << " search threads: " << config.nThreads;
+            cout << " average batch: " << stats.AverageBatchSize();
+            cout << " latency us: " << stats.AverageLatencyMicros();
+            cout << " evals/sec: " << static_cast<uint64_t>(player.GetStats().PlayoutsPerSecond()) << endl;
+        }
+    }
+
+    // Replays an archive of games and reports the first illegal turn of each
+    int RunValidation(const Game& game, const Options& options)
+    {
+        Position position;
+        if (!GetPosition(game, position))
+        {
+            cout << "Board is not supported by the validator" << endl;
+            return -1;
+        }
+
+        BatchValidator validator(position, options.mctsConfig.nThreads);
+        validator.SetDrawPlyLimit(options.drawPlyLimit);
+
+        ValidationReport report;
+        if (!validator.ValidateFile(options.validatePath, report))
+        {
+            cout << "Unable to read " << options.validatePath << endl;
+            return -1;
+        }
+
+        for (const auto& result : report.rejected)
+        {
+            cout << "line " << result.line << ": ply " << result.ply;
+            cout << " \'" << result.turn << "\' " << GetValidationErrorName(result.error) << endl;
+        }
+
+        cout << "games: " << report.nGames;
+        cout << " turns: " << report.nTurns;
+        cout << " rejected: " << report.rejected.size();
+        cout << " seconds: " << report.seconds << endl;
+
+        return report.rejected.empty() ? 0 : 1;
+    }
+
+    // Searches the board once and reports the best move. With a cache, a
+    // position analysed before resumes from the playouts already spent on it.
+    int RunAnalysis(const Game& game, const MctsConfig& config)
+    {
+        Position position;
+        if (!GetPosition(game, position))
+        {
+            cout << "Board is not supported by the search engine" << endl;
+            return -1;
+        }
+
+        MctsPlayer player(config);
+        Move bestMove;
+        if (!player.Search(position, bestMove))
+        {
+            cout << "No moves left to analyse" << endl;
+            return -1;
+        }
+
+        string input;
+        for (const auto& square : MoveToInputs(position.size, bestMove))
+        {
+            input += square + " ";
+        }
+
+        const auto& stats = player.GetStats();
+        cout << "best: " << input;
+        cout << "score: " << stats.score;
+        cout << " playouts: " << stats.nCachedVisits + stats.nPlayouts;
+        cout << " (" << stats.nCachedVisits << " cached)";
+        cout << " seconds: " << stats.seconds << endl;
+        return 0;
+    }
+
+    // Lets the search engine pick a move for the current player
+    vector<string> GetMctsInput(const Game& game, MctsPlayer& player)
+    {
+        Position position;
+        Move bestMove;
+        if (!GetPosition(game, position)
+            || !player.Search(position, bestMove))
+        {
+            return {};
+        }
+
+        return MoveToInputs(position.size, bestMove);
+    }
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-    // Initialize 8 x 8 board
-    Game game(8);
+    const Options options = ParseOptions(argc, argv);
+
+    // Initialize 8 x 8 board, international draughts is played on 10 x 10
+    Game game = options.international
+        ? Game(10, RuleVariant::International)
+        : Game(8);
+    game.SetDrawPlyLimit(options.drawPlyLimit);
 
     bool hasValidBoard = false;
     ifstream file("board.txt");
@@ -64,6 +349,74 @@ int main()
         game.InitializeBoard();
     }
 
+    // Leaf evaluation through the network is optional
+    Network network;
+    unique_ptr<BatchEvaluator> evaluator;
+    MctsConfig mctsConfig = options.mctsConfig;
+    mctsConfig.drawPlyLimit = options.drawPlyLimit;
+    if (!options.networkPath.empty())
+    {
+        if (!network.Load(options.networkPath))
+        {
+            cout << "Unable to load network from " << options.networkPath << endl;
+            return -1;
+        }
+
+        evaluator = make_unique<BatchEvaluator>(network, options.batchConfig);
+        mctsConfig.evaluator = evaluator.get();
+    }
+
+    if (!options.validatePath.empty())
+    {
+        return RunValidation(game, options);
+    }
+
+    if (options.mctsBench)
+    {
+        RunMctsBenchmark(game, mctsConfig);
+        return 0;
+    }
+
+    if (options.networkBench)
+    {
+        if (!network.IsLoaded())
+        {
+            cout << "--network-bench requires --network" << endl;
+            return -1;
+        }
+
+        RunNetworkBenchmark(game, network, options);
+        return 0;
+    }
+
+    // Search results are kept across sessions, analysis always uses a cache
+    AnalysisCache cache;
+    const string cachePath = options.cachePath.empty() && options.analyze
+        ? s_defaultCachePath
+        : options.cachePath;
+    if (!cachePath.empty())
+    {
+        if (!cache.Open(cachePath))
+        {
+            cout << "Unable to open analysis cache " << cachePath << endl;
+            return -1;
+        }
+
+        mctsConfig.cache = &cache;
+    }
+
+    if (options.analyze)
+    {
+        return RunAnalysis(game, mctsConfig);
+    }
+
+    // The search engine plays the x side when enabled
+    unique_ptr<MctsPlayer> mctsPlayer;
+    if (options.mctsPlayer)
+    {
+        mctsPlayer = make_unique<MctsPlayer>(mctsConfig);
+    }
+
     // Fetch input from player
     while (game.IsGameRunning())
     {
@@ -89,6 +442,8 @@ int main()
                 prompt += "\'x\'";
                 break;
             }
+            case PlayerSide::None:
+                break;
         }
         prompt += s_promptSuffix;
 
@@ -96,7 +451,44 @@ int main()
 
         // Get input from player
         string input;
-        getline(cin, input);
+        if (mctsPlayer && game.GetCurrentPlayerTurn() == PlayerSide::XPlayer)
+        {
+            for (const auto& move : GetMctsInput(game, *mctsPlayer))
+            {
+                input += move + " ";
+            }
+
+            const auto& stats = mctsPlayer->GetStats();
+            cout << input << "(" << stats.nPlayouts << " playouts, ";
+            cout << stats.nReusedVisits << " reused, ";
+            cout << static_cast<uint64_t>(stats.PlayoutsPerSecond()) << " playouts/sec)" << endl;
+        }
+        else
+        {
+            // Let the engine keep searching while the opponent thinks
+            Position position;
+            const bool isPondering = mctsPlayer && options.ponder && GetPosition(game, position);
+            if (isPondering)
+            {
+                mctsPlayer->StartPondering(position);
+            }
+
+            getline(cin, input);
+
+            if (isPondering)
+            {
+                mctsPlayer->StopPondering();
+
+                // The subtree of the actual reply is reused by the next search
+                Move predicted;
+                if (mctsPlayer->GetBestMove(predicted))
+                {
+                    const bool isHit = MoveToInputs(position.size, predicted) == SplitString(input);
+                    cout << "(pondered " << mctsPlayer->GetStats().nPlayouts << " playouts, ";
+                    cout << (isHit ? "predicted" : "missed") << " the reply)" << endl;
+                }
+            }
+        }
 
         // Parse input with the format
         auto parsedInput = SplitString(input);
@@ -125,5 +517,10 @@ int main()
             cout << "Player X wins!" << endl;
             return 2;
         }
+        case PlayerSide::None:
+        {
+            cout << "Game drawn!" << endl;
+            return 0;
+        }
     }
 }
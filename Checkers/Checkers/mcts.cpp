@@ -0,0 +1,633 @@
+#include "mcts.h"
+#include "cache.h"
+#include "movegen.h"
+#include "network.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+    // xorshift64*, each search thread owns one
+    class Random
+    {
+    public:
+        explicit Random(uint64_t seed) :
+            m_state(seed ? seed : 0x9E3779B97F4A7C15ull)
+        {}
+
+        uint32_t Next(uint32_t bound)
+        {
+            m_state ^= m_state >> 12;
+            m_state ^= m_state << 25;
+            m_state ^= m_state >> 27;
+            const uint64_t value = m_state * 0x2545F4914F6CDD1Dull;
+            return static_cast<uint32_t>((value >> 32) % bound);
+        }
+
+    private:
+        uint64_t m_state;
+    };
+
+    Outcome WinnerOutcome(PlayerSide winner)
+    {
+        switch (winner)
+        {
+            case PlayerSide::OPlayer:
+                return Outcome::OWins;
+            case PlayerSide::XPlayer:
+                return Outcome::XWins;
+            case PlayerSide::None:
+                break;
+        }
+
+        return Outcome::Draw;
+    }
+
+    // Score for the player that made the move into a node
+    uint32_t OutcomeScore(Outcome outcome, PlayerSide mover)
+    {
+        if (outcome == Outcome::Draw)
+            return s_winScore / 2;
+
+        return WinnerOutcome(mover) == outcome ? s_winScore : 0;
+    }
+
+    // Instantiated per rule variant, the playout never dispatches on the rules.
+    // The position stays in canonical form, it is mirrored after every move.
+    template <typename Rules>
+    Outcome Playout(Position position, const MctsConfig& config, Random& random, vector<Move>& moves)
+    {
+        PlayerSide side = position.sideToMove;
+        CanonicalPosition(position, position);
+
+        int nQuietPlies = 0;
+        for (int ply = 0; ply < config.maxPlayoutPlies; ++ply)
+        {
+            MoveGenerator<Rules>::GenerateCanonical(position, moves);
+
+            // A player without moves (or pieces) has lost
+            if (moves.empty())
+            {
+                return WinnerOutcome(Opponent(side));
+            }
+
+            // Kings shuffling around would otherwise run until maxPlayoutPlies
+            const Move& move = moves[random.Next(static_cast<uint32_t>(moves.size()))];
+            nQuietPlies = IsIrreversible(position, move) ? 0 : nQuietPlies + 1;
+            if (config.drawPlyLimit > 0 && nQuietPlies >= config.drawPlyLimit)
+            {
+                return Outcome::Draw;
+            }
+
+            ApplyMove(position, move);
+            position = MirrorPosition(position);
+            side = Opponent(side);
+        }
+
+        return Outcome::Draw;
+    }
+}
+
+//------------------------------------------------------------------------
+// NodePool Implementation
+//------------------------------------------------------------------------
+uint32_t NodePool::Allocate(uint32_t count)
+{
+    uint32_t first = m_next.load(memory_order_relaxed);
+    do
+    {
+        if (m_capacity - first < count)
+        {
+            return s_invalidNode;
+        }
+    } while (!m_next.compare_exchange_weak(first, first + count));
+
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        MctsNode& node = m_nodes[i];
+        node.firstChild = 0;
+        node.nChildren = 0;
+        node.isTerminal = false;
+        node.prior.store(0.0f, memory_order_relaxed);
+        node.state.store(NodeState::Unexpanded, memory_order_relaxed);
+        node.nVisits.store(0, memory_order_relaxed);
+        node.score.store(0, memory_order_relaxed);
+    }
+
+    return first;
+}
+
+void NodePool::Reset()
+{
+    m_next = 0;
+}
+
+uint32_t NodePool::Compact(uint32_t root)
+{
+    // Mark the subtree, children blocks are always kept whole
+    vector<uint32_t> forward(m_next, s_invalidNode);
+    vector<uint32_t> pending = { root };
+    forward[root] = 0;
+    while (!pending.empty())
+    {
+        const MctsNode& node = m_nodes[pending.back()];
+        pending.pop_back();
+
+        for (uint32_t i = node.firstChild; i < node.firstChild + node.nChildren; ++i)
+        {
+            forward[i] = 0;
+            pending.push_back(i);
+        }
+    }
+
+    // Nodes keep their allocation order, so every node moves towards the
+    // front and never overwrites one that has yet to move
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < m_next; ++i)
+    {
+        if (forward[i] != s_invalidNode)
+        {
+            forward[i] = next++;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_next; ++i)
+    {
+        if (forward[i] == s_invalidNode)
+            continue;
+
+        const MctsNode& from = m_nodes[i];
+        MctsNode& to = m_nodes[forward[i]];
+        to.move = from.move;
+        to.firstChild = from.nChildren > 0 ? forward[from.firstChild] : 0;
+        to.nChildren = from.nChildren;
+        to.isTerminal = from.isTerminal;
+        to.terminalOutcome = from.terminalOutcome;
+        to.state.store(from.state.load(memory_order_relaxed), memory_order_relaxed);
+        to.nVisits.store(from.nVisits.load(memory_order_relaxed), memory_order_relaxed);
+        to.prior.store(from.prior.load(memory_order_relaxed), memory_order_relaxed);
+        to.score.store(from.score.load(memory_order_relaxed), memory_order_relaxed);
+    }
+
+    m_next = next;
+    return forward[root];
+}
+
+uint32_t NodePool::Size() const
+{
+    return m_next;
+}
+
+uint32_t NodePool::Capacity() const
+{
+    return m_capacity;
+}
+
+//------------------------------------------------------------------------
+// MctsPlayer Implementation - Public API
+//------------------------------------------------------------------------
+MctsPlayer::~MctsPlayer()
+{
+    StopPondering();
+}
+
+bool MctsPlayer::Search(const Position& position, Move& bestMove)
+{
+    StopPondering();
+
+    const uint32_t nReusedVisits = SetRoot(position);
+
+    // Playouts of an earlier session count towards this search
+    const uint32_t nCachedVisits = nReusedVisits == 0 ? SeedFromCache(position) : 0;
+    RunSearch(m_config.nPlayouts > nCachedVisits ? m_config.nPlayouts - nCachedVisits : 0);
+    m_stats.nReusedVisits = nReusedVisits;
+    m_stats.nCachedVisits = nCachedVisits;
+
+    const uint32_t best = GetBestChild();
+    if (best == NodePool::s_invalidNode)
+    {
+        return false;
+    }
+
+    MctsNode& node = m_pool[best];
+    bestMove = node.move;
+    m_stats.score = node.nVisits > 0 ? double(node.score) / node.nVisits / s_winScore : 0.0;
+
+    if (m_config.cache && m_stats.nPlayouts > 0)
+    {
+        // The root also counts the playout that expanded it, so a search of
+        // the same depth is complete as soon as the result is seeded
+        const MctsNode& root = m_pool[m_root];
+        AnalysisResult result;
+        result.nPlayouts = root.nVisits;
+        result.score = static_cast<uint32_t>(m_stats.score * s_winScore + 0.5);
+        result.bestMove = bestMove;
+
+        // Every visited move is kept, a later search resumes from all of them
+        for (uint32_t i = root.firstChild; i < root.firstChild + root.nChildren; ++i)
+        {
+            const MctsNode& child = m_pool[i];
+            if (child.nVisits > 0)
+            {
+                MoveStats stats;
+                stats.move = child.move;
+                stats.nVisits = child.nVisits;
+                stats.score = child.score;
+                result.moves.push_back(stats);
+            }
+        }
+
+        m_config.cache->Store(position, result);
+    }
+
+    return true;
+}
+
+void MctsPlayer::StartPondering(const Position& position)
+{
+    StopPondering();
+    SetRoot(position);
+    m_ponderThread = thread(&MctsPlayer::RunSearch, this, UINT64_MAX);
+}
+
+void MctsPlayer::StopPondering()
+{
+    if (!m_ponderThread.joinable())
+    {
+        return;
+    }
+
+    m_stop = true;
+    m_ponderThread.join();
+    m_stop = false;
+}
+
+bool MctsPlayer::GetBestMove(Move& bestMove)
+{
+    const uint32_t best = GetBestChild();
+    if (best == NodePool::s_invalidNode)
+    {
+        return false;
+    }
+
+    bestMove = m_pool[best].move;
+    return true;
+}
+
+const MctsStats& MctsPlayer::GetStats() const
+{
+    return m_stats;
+}
+
+//------------------------------------------------------------------------
+// MctsPlayer Implementation - Private API
+//------------------------------------------------------------------------
+uint32_t MctsPlayer::SetRoot(const Position& position)
+{
+    if (m_root != NodePool::s_invalidNode)
+    {
+        uint32_t index = FindDescendant(m_root, m_rootPosition, position, 2);
+        if (index != NodePool::s_invalidNode)
+        {
+            // Nodes of discarded siblings are only reclaimed once the pool
+            // runs low, a long ponder fills most of it
+            if (m_pool.Size() >= m_pool.Capacity() / 4 * 3)
+            {
+                index = m_pool.Compact(index);
+            }
+
+            m_root = index;
+            m_rootPosition = position;
+            return m_pool[index].nVisits;
+        }
+    }
+
+    m_pool.Reset();
+    m_root = m_pool.Allocate(1);
+    m_rootPosition = position;
+    return 0;
+}
+
+uint32_t MctsPlayer::SeedFromCache(const Position& position)
+{
+    AnalysisResult cached;
+    if (!m_config.cache || !m_config.cache->Lookup(position, cached))
+    {
+        return 0;
+    }
+
+    vector<Move> moves;
+    MctsNode& root = m_pool[m_root];
+    NodeState expected = NodeState::Unexpanded;
+    if (root.state.compare_exchange_strong(expected, NodeState::Expanding))
+    {
+        Expand(m_root, position, moves);
+    }
+
+    // The children get the statistics of the earlier search back, so the
+    // new playouts are spread over the moves as if it had never stopped
+    uint32_t nVisits = 0;
+    uint64_t score = 0;
+    for (uint32_t i = root.firstChild; i < root.firstChild + root.nChildren; ++i)
+    {
+        MctsNode& child = m_pool[i];
+        const auto it = find_if(cached.moves.begin(), cached.moves.end(), [&](const MoveStats& stats)
+            { return IsSameMove(child.move, stats.move); });
+        if (it != cached.moves.end() && it->nVisits > 0)
+        {
+            child.nVisits = it->nVisits;
+            child.score = it->score;
+            nVisits += it->nVisits;
+            score += uint64_t(s_winScore) * it->nVisits - it->score;
+        }
+    }
+
+    if (nVisits == 0)
+    {
+        return 0;
+    }
+
+    // Root visits that never reached a child are scored like the cached result
+    const uint32_t nRootVisits = max(nVisits, cached.nPlayouts);
+    root.nVisits = nRootVisits;
+    root.score = score + uint64_t(s_winScore - cached.score) * (nRootVisits - nVisits);
+    return nRootVisits;
+}
+
+uint32_t MctsPlayer::GetBestChild()
+{
+    // The most visited move is the most robust choice
+    MctsNode& root = m_pool[m_root];
+    if (root.state != NodeState::Expanded || root.nChildren == 0)
+    {
+        return NodePool::s_invalidNode;
+    }
+
+    uint32_t best = root.firstChild;
+    for (uint32_t i = root.firstChild; i < root.firstChild + root.nChildren; ++i)
+    {
+        if (m_pool[i].nVisits > m_pool[best].nVisits)
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+uint32_t MctsPlayer::FindDescendant(uint32_t index, const Position& from, const Position& position, int depth)
+{
+    if (from == position)
+    {
+        return index;
+    }
+
+    // Two plies cover our own move followed by the opponent's reply
+    const MctsNode& node = m_pool[index];
+    if (depth == 0 || node.state != NodeState::Expanded)
+    {
+        return NodePool::s_invalidNode;
+    }
+
+    for (uint32_t child = node.firstChild; child < node.firstChild + node.nChildren; ++child)
+    {
+        Position next = from;
+        ApplyMove(next, m_pool[child].move);
+
+        const uint32_t found = FindDescendant(child, next, position, depth - 1);
+        if (found != NodePool::s_invalidNode)
+        {
+            return found;
+        }
+    }
+
+    return NodePool::s_invalidNode;
+}
+
+void MctsPlayer::RunSearch(uint64_t nPlayouts)
+{
+    m_playoutLimit = nPlayouts;
+    m_nStarted = 0;
+    m_nFinished = 0;
+
+    const auto start = chrono::steady_clock::now();
+
+    const int nThreads = m_config.nThreads > 0 ? m_config.nThreads : 1;
+    vector<thread> workers;
+    for (int i = 1; i < nThreads; ++i)
+    {
+        workers.emplace_back(&MctsPlayer::RunWorker, this, i + 1);
+    }
+    RunWorker(1);
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    m_stats.nPlayouts = m_nFinished;
+    m_stats.nNodes = m_pool.Size();
+    m_stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    m_stats.nReusedVisits = 0;
+    m_stats.nCachedVisits = 0;
+    m_stats.score = 0.0;
+}
+
+void MctsPlayer::RunWorker(uint64_t seed)
+{
+    Random random(seed * 0x9E3779B97F4A7C15ull);
+    vector<Move> moves;
+    moves.reserve(64);
+
+    // Node and the player who made the move into it
+    vector<pair<uint32_t, PlayerSide>> path;
+
+    while (!m_stop && m_nStarted.fetch_add(1) < m_playoutLimit)
+    {
+        Position position = m_rootPosition;
+        uint32_t index = m_root;
+
+        path.clear();
+        m_pool[index].nVisits++;
+        path.emplace_back(index, Opponent(position.sideToMove));
+
+        // Selection
+        while (m_pool[index].state.load(memory_order_acquire) == NodeState::Expanded
+            && m_pool[index].nChildren > 0)
+        {
+            const PlayerSide mover = position.sideToMove;
+            index = SelectChild(m_pool[index]);
+            ApplyMove(position, m_pool[index].move);
+
+            m_pool[index].nVisits++;
+            path.emplace_back(index, mover);
+        }
+
+        // Expansion, threads that lose the race simply run a playout from here
+        MctsNode& leaf = m_pool[index];
+        NodeState expected = NodeState::Unexpanded;
+        if (leaf.state.compare_exchange_strong(expected, NodeState::Expanding))
+        {
+            Expand(index, position, moves);
+        }
+
+        // Simulation, scored for the player who made the move into the leaf
+        uint32_t leafScore;
+        const PlayerSide leafMover = path.back().second;
+        if (leaf.state.load(memory_order_acquire) == NodeState::Expanded && leaf.isTerminal)
+        {
+            leafScore = OutcomeScore(leaf.terminalOutcome, leafMover);
+        }
+        else if (m_config.evaluator)
+        {
+            leafScore = Evaluate(index, position);
+        }
+        else
+        {
+            const Outcome outcome = VisitRules(position.variant, [&](auto rules)
+            {
+                return Playout<decltype(rules)>(position, m_config, random, moves);
+            });
+            leafScore = OutcomeScore(outcome, leafMover);
+        }
+
+        // Backpropagation
+        for (const auto& step : path)
+        {
+            m_pool[step.first].score += step.second == leafMover ? leafScore : s_winScore - leafScore;
+        }
+
+        m_nFinished++;
+    }
+}
+
+void MctsPlayer::Expand(uint32_t index, const Position& position, vector<Move>& moves)
+{
+    MctsNode& node = m_pool[index];
+
+    PlayerSide winner;
+    if (GetTerminalWinner(position, winner))
+    {
+        node.isTerminal = true;
+        node.terminalOutcome = WinnerOutcome(winner);
+        node.state.store(NodeState::Expanded, memory_order_release);
+        return;
+    }
+
+    GenerateMoves(position, moves);
+
+    // Once the pool is exhausted the node stays a leaf and keeps running playouts
+    const uint32_t first = m_pool.Allocate(static_cast<uint32_t>(moves.size()));
+    if (first != NodePool::s_invalidNode)
+    {
+        const float prior = 1.0f / moves.size();
+        for (size_t i = 0; i < moves.size(); ++i)
+        {
+            m_pool[first + static_cast<uint32_t>(i)].move = moves[i];
+            m_pool[first + static_cast<uint32_t>(i)].prior.store(prior, memory_order_relaxed);
+        }
+
+        node.firstChild = first;
+        node.nChildren = static_cast<uint16_t>(moves.size());
+    }
+
+    node.state.store(NodeState::Expanded, memory_order_release);
+}
+
+uint32_t MctsPlayer::Evaluate(uint32_t index, const Position& position)
+{
+    const NetworkOutput output = m_config.evaluator->Evaluate(position);
+
+    // Children of a node expanded by another thread may not be published yet
+    MctsNode& node = m_pool[index];
+    if (node.state.load(memory_order_acquire) == NodeState::Expanded && node.nChildren > 0)
+    {
+        // Softmax over the logits of the legal moves only
+        float maxLogit = -1e30f;
+        for (uint32_t i = node.firstChild; i < node.firstChild + node.nChildren; ++i)
+        {
+            maxLogit = max(maxLogit, output.policy[PolicyIndex(position, m_pool[i].move)]);
+        }
+
+        float total = 0.0f;
+        for (uint32_t i = node.firstChild; i < node.firstChild + node.nChildren; ++i)
+        {
+            total += exp(output.policy[PolicyIndex(position, m_pool[i].move)] - maxLogit);
+        }
+
+        for (uint32_t i = node.firstChild; i < node.firstChild + node.nChildren; ++i)
+        {
+            const float weight = exp(output.policy[PolicyIndex(position, m_pool[i].move)] - maxLogit);
+            m_pool[i].prior.store(weight / total, memory_order_relaxed);
+        }
+    }
+
+    // The network scores the side to move, which is the opponent of the leaf mover
+    const float value = min(1.0f, max(-1.0f, output.value));
+    return static_cast<uint32_t>((1.0f - value) * 0.5f * s_winScore);
+}
+
+uint32_t MctsPlayer::SelectChild(MctsNode& node)
+{
+    if (m_config.evaluator)
+    {
+        return SelectChildPuct(node);
+    }
+
+    // UCT: average score plus an exploration bonus for rarely visited children
+    const double logParent = log(static_cast<double>(node.nVisits.load()));
+
+    uint32_t best = node.firstChild;
+    double bestValue = -1.0;
+    for (uint32_t i = node.firstChild; i < node.firstChild + node.nChildren; ++i)
+    {
+        const MctsNode& child = m_pool[i];
+        const uint32_t nVisits = child.nVisits.load(memory_order_relaxed);
+        if (nVisits == 0)
+        {
+            return i;
+        }
+
+        const double mean = child.score.load(memory_order_relaxed) / (double(s_winScore) * nVisits);
+        const double value = mean + m_config.exploration * sqrt(logParent / nVisits);
+        if (value > bestValue)
+        {
+            bestValue = value;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+uint32_t MctsPlayer::SelectChildPuct(MctsNode& node)
+{
+    // PUCT: the exploration bonus is weighted by the network prior
+    const double sqrtParent = sqrt(static_cast<double>(node.nVisits.load()));
+
+    uint32_t best = node.firstChild;
+    double bestValue = -1.0;
+    for (uint32_t i = node.firstChild; i < node.firstChild + node.nChildren; ++i)
+    {
+        const MctsNode& child = m_pool[i];
+        const uint32_t nVisits = child.nVisits.load(memory_order_relaxed);
+
+        // Unvisited children are assumed to be even
+        const double mean = nVisits > 0
+            ? child.score.load(memory_order_relaxed) / (double(s_winScore) * nVisits)
+            : 0.5;
+        const double value = mean + m_config.exploration * child.prior.load(memory_order_relaxed) * sqrtParent / (1 + nVisits);
+        if (value > bestValue)
+        {
+            bestValue = value;
+            best = i;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "rules.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+class AnalysisCache;
+class BatchEvaluator;
+
+// Score of a single won playout, a draw is worth half of it
+constexpr uint32_t s_winScore = 1000;
+
+enum class Outcome : uint8_t
+{
+    OWins,
+    XWins,
+    Draw,
+};
+
+struct MctsConfig
+{
+    int nThreads = 1;
+    uint64_t nPlayouts = 20000;
+    double exploration = 1.4;
+
+    // Playouts longer than this, or without progress for drawPlyLimit plies,
+    // are scored as a draw
+    int maxPlayoutPlies = 200;
+    int drawPlyLimit = s_defaultDrawPlyLimit;
+    uint32_t nodePoolSize = 1 << 20;
+
+    // When set, leaves are scored by the network instead of random playouts
+    // and its policy is used as the prior of the PUCT selection
+    BatchEvaluator* evaluator = nullptr;
+
+    // When set, searches resume from the playouts of earlier sessions and
+    // store their own result
+    AnalysisCache* cache = nullptr;
+};
+
+struct MctsStats
+{
+    double PlayoutsPerSecond() const
+    {
+        return seconds > 0.0 ? nPlayouts / seconds : 0.0;
+    }
+
+    uint64_t nPlayouts = 0;
+    uint32_t nNodes = 0;
+    double seconds = 0.0;
+
+    // Visits already in the tree when the search started
+    uint32_t nReusedVisits = 0;
+
+    // Playouts of an earlier session taken from the analysis cache
+    uint32_t nCachedVisits = 0;
+
+    // Expected score of the best move for the side to move, from 0 to 1
+    double score = 0.0;
+};
+
+enum class NodeState : uint8_t
+{
+    Unexpanded,
+    Expanding,
+    Expanded,
+};
+
+struct MctsNode
+{
+    // Move that leads from the parent to this node
+    Move move;
+    uint32_t firstChild = 0;
+    uint16_t nChildren = 0;
+    bool isTerminal = false;
+    Outcome terminalOutcome = Outcome::Draw;
+
+    // Children are published by storing Expanded with release semantics
+    atomic<NodeState> state;
+
+    // Visits are counted when a thread descends through the node, which acts
+    // as a virtual loss until the playout result is added to the score
+    atomic<uint32_t> nVisits;
+
+    // Network policy prior, may be refined while other threads are selecting
+    atomic<float> prior;
+
+    // Sum of results from the point of view of the player who made the move
+    atomic<uint64_t> score;
+};
+
+// Arena of nodes, children of a node are always allocated contiguously
+class NodePool
+{
+public:
+    static constexpr uint32_t s_invalidNode = UINT32_MAX;
+
+    explicit NodePool(uint32_t capacity) :
+        m_capacity(capacity),
+        m_next(0),
+        m_nodes(new MctsNode[capacity])
+    {}
+
+    uint32_t Allocate(uint32_t count);
+    void Reset();
+
+    // Keeps only the subtree of root and slides it to the front of the pool,
+    // returns the new index of root. No search may run at the same time.
+    uint32_t Compact(uint32_t root);
+
+    MctsNode& operator[](uint32_t index)
+    {
+        return m_nodes[index];
+    }
+
+    uint32_t Size() const;
+    uint32_t Capacity() const;
+
+private:
+    const uint32_t m_capacity;
+    atomic<uint32_t> m_next;
+    unique_ptr<MctsNode[]> m_nodes;
+};
+
+class MctsPlayer
+{
+public:
+    explicit MctsPlayer(const MctsConfig& config) :
+        m_config(config),
+        m_pool(config.nodePoolSize),
+        m_root(NodePool::s_invalidNode),
+        m_playoutLimit(0),
+        m_stop(false),
+        m_nStarted(0),
+        m_nFinished(0)
+    {}
+
+    ~MctsPlayer();
+
+    // Searches the position and returns the most visited move. The tree of
+    // the previous search or ponder is reused when the position is part of it.
+    bool Search(const Position& position, Move& bestMove);
+
+    // Keeps searching the position on a background thread until the next
+    // Search() or StopPondering()
+    void StartPondering(const Position& position);
+    void StopPondering();
+
+    // Most visited move of the current root, i.e. the predicted reply while pondering
+    bool GetBestMove(Move& bestMove);
+
+    const MctsStats& GetStats() const;
+
+private:
+    uint32_t SetRoot(const Position& position);
+    uint32_t SeedFromCache(const Position& position);
+    uint32_t GetBestChild();
+    uint32_t FindDescendant(uint32_t index, const Position& from, const Position& position, int depth);
+    void RunSearch(uint64_t nPlayouts);
+    void RunWorker(uint64_t seed);
+    void Expand(uint32_t index, const Position& position, vector<Move>& moves);
+    uint32_t Evaluate(uint32_t index, const Position& position);
+    uint32_t SelectChild(MctsNode& node);
+    uint32_t SelectChildPuct(MctsNode& node);
+
+    const MctsConfig m_config;
+    NodePool m_pool;
+    uint32_t m_root;
+    Position m_rootPosition;
+
+    uint64_t m_playoutLimit;
+    atomic<bool> m_stop;
+    thread m_ponderThread;
+
+    atomic<uint64_t> m_nStarted;
+    atomic<uint64_t> m_nFinished;
+    MctsStats m_stats;
+};
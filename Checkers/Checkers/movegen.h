@@ -0,0 +1,324 @@
+#pragma once
+
+#include "rules.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Rule variants are compile-time policies, every variant gets its own copy of
+// the move generator without any rule checks left in the inner loops.
+// Both variants let a turn stop at any landing square of a capture chain,
+// capturing is never mandatory.
+
+// Rules the Game has always played
+struct StandardRules
+{
+    static constexpr RuleVariant s_variant = RuleVariant::Standard;
+
+    // Kings move and capture a single square at a time
+    static constexpr bool s_flyingKings = false;
+
+    // Regular pieces only capture forwards
+    static constexpr bool s_menCaptureBackward = false;
+
+    // A regular piece reaching the far row mid capture continues as a king
+    static constexpr bool s_promoteDuringCapture = true;
+
+    // Captured pieces leave the board as soon as they are jumped
+    static constexpr bool s_removeCapturedAtEnd = false;
+};
+
+// International draughts, usually played on a 10 x 10 board
+struct InternationalRules
+{
+    static constexpr RuleVariant s_variant = RuleVariant::International;
+
+    // Kings move and capture along the whole diagonal
+    static constexpr bool s_flyingKings = true;
+    static constexpr bool s_menCaptureBackward = true;
+
+    // Only a turn that ends on the far row promotes
+    static constexpr bool s_promoteDuringCapture = false;
+
+    // Captured pieces stay on the board until the turn is over: they block
+    // the capturing piece but can't be jumped a second time
+    static constexpr bool s_removeCapturedAtEnd = true;
+};
+
+// Calls visitor with the policy of the variant, so callers can dispatch
+// once and then stay on the specialized path
+template <typename Visitor>
+auto VisitRules(RuleVariant variant, Visitor&& visitor)
+{
+    switch (variant)
+    {
+        case RuleVariant::International:
+            return visitor(InternationalRules());
+        case RuleVariant::Standard:
+            break;
+    }
+
+    return visitor(StandardRules());
+}
+
+// Up is towards row 0, which is where o pieces are heading. The generator
+// only plays o, x moves are generated on the mirrored position.
+constexpr int s_rowDelta[s_nDirections] = { -1, -1, 1, 1 };
+constexpr int s_colDelta[s_nDirections] = { -1, 1, -1, 1 };
+
+inline int PopLowestSquare(SquareMask& mask)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    const int square = static_cast<int>(index);
+#elif defined(_MSC_VER)
+    // 32-bit targets can only scan one half of the mask at a time
+    unsigned long index;
+    int square;
+    if (_BitScanForward(&index, static_cast<unsigned long>(mask)))
+    {
+        square = static_cast<int>(index);
+    }
+    else
+    {
+        _BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+        square = static_cast<int>(index) + 32;
+    }
+#else
+    const int square = __builtin_ctzll(mask);
+#endif
+    mask &= mask - 1;
+    return square;
+}
+
+inline bool IsForward(int dir)
+{
+    return s_rowDelta[dir] < 0;
+}
+
+inline bool IsPromotionSquare(const DiagonalTables& tables, int square)
+{
+    return tables.row[square] == 0;
+}
+
+template <typename Rules>
+class MoveGenerator
+{
+public:
+    // Either side to move, x positions are mirrored back and forth
+    static void Generate(const Position& position, vector<Move>& moves);
+    static bool HasAnyMove(const Position& position, PlayerSide side);
+
+    // Side agnostic core, the position must be in canonical form (o to move)
+    static void GenerateCanonical(const Position& position, vector<Move>& moves);
+    static bool HasAnyMoveCanonical(const Position& position);
+
+private:
+    static bool CanCapture(bool isKing, int dir)
+    {
+        return Rules::s_menCaptureBackward || isKing || IsForward(dir);
+    }
+
+    static bool IsFlying(bool isKing)
+    {
+        return Rules::s_flyingKings && isKing;
+    }
+
+    // First occupied square along the diagonal, only flying kings look past
+    // the neighbouring square
+    static int FindTarget(const DiagonalTables& tables, int square, int dir, bool isKing, SquareMask occupied)
+    {
+        int target = tables.neighbour[square][dir];
+        if (IsFlying(isKing))
+        {
+            while (target != s_invalidSquare && !(occupied & SquareBit(target)))
+            {
+                target = tables.neighbour[target][dir];
+            }
+        }
+        return target;
+    }
+
+    static void GenerateCaptures(
+        const DiagonalTables& tables,
+        const Move& move,
+        int square,
+        bool isKing,
+        SquareMask occupied,
+        SquareMask opponents,
+        vector<Move>& moves);
+};
+
+//------------------------------------------------------------------------
+// MoveGenerator Implementation
+//------------------------------------------------------------------------
+template <typename Rules>
+void MoveGenerator<Rules>::Generate(const Position& position, vector<Move>& moves)
+{
+    if (position.sideToMove == PlayerSide::OPlayer)
+    {
+        GenerateCanonical(position, moves);
+        return;
+    }
+
+    GenerateCanonical(MirrorPosition(position), moves);
+    for (auto& move : moves)
+    {
+        move = MirrorMove(position.size, move);
+    }
+}
+
+template <typename Rules>
+bool MoveGenerator<Rules>::HasAnyMove(const Position& position, PlayerSide side)
+{
+    return side == PlayerSide::OPlayer
+        ? HasAnyMoveCanonical(position)
+        : HasAnyMoveCanonical(MirrorPosition(position));
+}
+
+template <typename Rules>
+void MoveGenerator<Rules>::GenerateCanonical(const Position& position, vector<Move>& moves)
+{
+    moves.clear();
+
+    const auto& tables = GetDiagonalTables(position.size);
+    const SquareMask occupied = position.oPieces | position.xPieces;
+
+    SquareMask pieces = position.oPieces;
+    while (pieces)
+    {
+        const int origin = PopLowestSquare(pieces);
+        const bool isKing = (position.kings & SquareBit(origin)) != 0;
+
+        Move move;
+        move.origin = origin;
+
+        // Non capturing moves, flying kings may stop on any square of the ray
+        for (int dir = 0; dir < s_nDirections; ++dir)
+        {
+            if (!isKing && !IsForward(dir))
+                continue;
+
+            for (int dest = tables.neighbour[origin][dir];
+                dest != s_invalidSquare && !(occupied & SquareBit(dest));
+                dest = tables.neighbour[dest][dir])
+            {
+                Move step = move;
+                step.path[step.nHops++] = dest;
+                step.promotes = !isKing && IsPromotionSquare(tables, dest);
+                moves.push_back(step);
+
+                if (!IsFlying(isKing))
+                    break;
+            }
+        }
+
+        // Capture chains, the moving piece no longer blocks its origin
+        GenerateCaptures(
+            tables,
+            move,
+            origin,
+            isKing,
+            occupied & ~SquareBit(origin),
+            position.xPieces,
+            moves);
+    }
+}
+
+template <typename Rules>
+bool MoveGenerator<Rules>::HasAnyMoveCanonical(const Position& position)
+{
+    const auto& tables = GetDiagonalTables(position.size);
+    const SquareMask occupied = position.oPieces | position.xPieces;
+
+    SquareMask pieces = position.oPieces;
+    while (pieces)
+    {
+        const int origin = PopLowestSquare(pieces);
+        const bool isKing = (position.kings & SquareBit(origin)) != 0;
+
+        for (int dir = 0; dir < s_nDirections; ++dir)
+        {
+            const int next = tables.neighbour[origin][dir];
+            if (next == s_invalidSquare)
+                continue;
+
+            if (!(occupied & SquareBit(next)))
+            {
+                if (isKing || IsForward(dir))
+                    return true;
+            }
+
+            if (!CanCapture(isKing, dir))
+                continue;
+
+            const int target = FindTarget(tables, origin, dir, isKing, occupied);
+            if (target == s_invalidSquare || !(position.xPieces & SquareBit(target)))
+                continue;
+
+            const int dest = tables.neighbour[target][dir];
+            if (dest != s_invalidSquare && !(occupied & SquareBit(dest)))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+template <typename Rules>
+void MoveGenerator<Rules>::GenerateCaptures(
+    const DiagonalTables& tables,
+    const Move& move,
+    int square,
+    bool isKing,
+    SquareMask occupied,
+    SquareMask opponents,
+    vector<Move>& moves)
+{
+    if (move.nHops >= s_maxHops)
+    {
+        return;
+    }
+
+    for (int dir = 0; dir < s_nDirections; ++dir)
+    {
+        if (!CanCapture(isKing, dir))
+            continue;
+
+        const int jumped = FindTarget(tables, square, dir, isKing, occupied);
+        if (jumped == s_invalidSquare || !(opponents & SquareBit(jumped)))
+            continue;
+
+        const SquareMask nextOccupied = Rules::s_removeCapturedAtEnd
+            ? occupied
+            : occupied & ~SquareBit(jumped);
+
+        for (int dest = tables.neighbour[jumped][dir];
+            dest != s_invalidSquare && !(occupied & SquareBit(dest));
+            dest = tables.neighbour[dest][dir])
+        {
+            Move next = move;
+            next.path[next.nHops++] = dest;
+            next.captured |= SquareBit(jumped);
+
+            const bool promotes = !isKing && IsPromotionSquare(tables, dest);
+            next.promotes = Rules::s_promoteDuringCapture ? next.promotes || promotes : promotes;
+            moves.push_back(next);
+
+            GenerateCaptures(
+                tables,
+                next,
+                dest,
+                Rules::s_promoteDuringCapture ? isKing || promotes : isKing,
+                nextOccupied,
+                opponents & ~SquareBit(jumped),
+                moves);
+
+            // Flying kings may land on any empty square behind the captured piece
+            if (!IsFlying(isKing))
+                break;
+        }
+    }
+}
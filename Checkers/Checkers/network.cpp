@@ -0,0 +1,359 @@
+#include "network.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// The AVX2 kernel is compiled on its own and only used when the CPU has
+// AVX2, the rest of the program keeps the baseline instruction set
+#if defined(_M_X64) || defined(__x86_64__)
+#define HAS_AVX2_KERNEL
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+namespace
+{
+    constexpr char s_networkMagic[4] = { 'C', 'K', 'N', 'N' };
+    constexpr uint32_t s_networkVersion = 1;
+
+    // Activations are unsigned (inputs are 0/1, hidden units are ReLU),
+    // weights are signed, n is always a multiple of s_simdWidth
+    int32_t DotProductScalar(const uint8_t* activations, const int8_t* weights, int n)
+    {
+        int32_t sum = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            sum += int32_t(activations[i]) * int32_t(weights[i]);
+        }
+        return sum;
+    }
+
+#ifdef HAS_AVX2_KERNEL
+    AVX2_TARGET int32_t DotProductAvx2(const uint8_t* activations, const int8_t* weights, int n)
+    {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i sum = _mm256_setzero_si256();
+        for (int i = 0; i < n; i += s_simdWidth)
+        {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(activations + i));
+            const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+
+            // u8 x s8 pairs summed into s16, then pairs of s16 summed into s32
+            const __m256i products = _mm256_maddubs_epi16(a, w);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+        }
+
+        __m128i total = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        total = _mm_hadd_epi32(total, total);
+        total = _mm_hadd_epi32(total, total);
+        return _mm_cvtsi128_si32(total);
+    }
+
+    bool HasAvx2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        // The OS must also save the upper halves of the ymm registers
+        __cpuid(info, 1);
+        const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+        const bool hasAvx = (info[2] & (1 << 28)) != 0;
+        if (!hasOsxsave || !hasAvx || (_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    using DotProductFunction = int32_t (*)(const uint8_t*, const int8_t*, int);
+
+    DotProductFunction SelectDotProduct()
+    {
+#ifdef HAS_AVX2_KERNEL
+        if (HasAvx2())
+        {
+            return DotProductAvx2;
+        }
+#endif
+        return DotProductScalar;
+    }
+
+    // Picked once at startup from the CPU the program runs on
+    const DotProductFunction DotProduct = SelectDotProduct();
+
+    template <typename T>
+    bool ReadValues(ifstream& file, T* values, size_t count)
+    {
+        file.read(reinterpret_cast<char*>(values), count * sizeof(T));
+        return static_cast<bool>(file);
+    }
+}
+
+//------------------------------------------------------------------------
+// Encoding
+//------------------------------------------------------------------------
+void EncodePosition(const Position& position, NetworkInput& input)
+{
+    input.fill(0);
+
+    // The side to move is always o in the canonical form
+    Position canonical;
+    CanonicalPosition(position, canonical);
+    const SquareMask planes[s_nInputPlanes] =
+    {
+        canonical.oPieces & ~canonical.kings,
+        canonical.oPieces & canonical.kings,
+        canonical.xPieces & ~canonical.kings,
+        canonical.xPieces & canonical.kings,
+    };
+
+    const int nSquares = GetDiagonalTables(position.size).nSquares;
+    for (int plane = 0; plane < s_nInputPlanes; ++plane)
+    {
+        for (int square = 0; square < nSquares; ++square)
+        {
+            if (planes[plane] & SquareBit(square))
+            {
+                input[plane * s_maxSquares + square] = 1;
+            }
+        }
+    }
+}
+
+int PolicyIndex(const Position& position, const Move& move)
+{
+    const auto& tables = GetDiagonalTables(position.size);
+    const bool isMirrored = position.sideToMove != PlayerSide::OPlayer;
+    const int origin = isMirrored ? MirrorSquare(position.size, move.origin) : move.origin;
+    const int dest = isMirrored ? MirrorSquare(position.size, move.path[0]) : move.path[0];
+
+    int dir = 0;
+    if (tables.row[dest] > tables.row[origin])
+        dir += 2;
+    if (tables.col[dest] > tables.col[origin])
+        dir += 1;
+
+    return origin * s_nDirections + dir;
+}
+
+//------------------------------------------------------------------------
+// Network Implementation
+//------------------------------------------------------------------------
+bool Network::Load(const string& path)
+{
+    ifstream file(path, ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t header[4];
+    float scales[2];
+    if (!ReadValues(file, magic, 4)
+        || memcmp(magic, s_networkMagic, sizeof(magic)) != 0
+        || !ReadValues(file, header, 4)
+        || !ReadValues(file, scales, 2))
+    {
+        return false;
+    }
+
+    const uint32_t version = header[0];
+    const uint32_t nInputs = header[1];
+    const uint32_t nHidden = header[2];
+    const uint32_t nOutputs = header[3];
+    if (version != s_networkVersion
+        || nInputs != s_nInputs
+        || nOutputs != s_nOutputs
+        || nHidden == 0
+        || nHidden % s_simdWidth != 0
+        || nHidden > 4096)
+    {
+        cerr << "Unsupported network layout in " << path << endl;
+        return false;
+    }
+
+    // Hidden rows are stored unpadded in the file
+    vector<int32_t> hiddenBias(nHidden);
+    vector<int8_t> hiddenWeights(size_t(nHidden) * s_nInputsPadded, 0);
+    vector<int32_t> outputBias(nOutputs);
+    vector<int8_t> outputWeights(size_t(nOutputs) * nHidden);
+
+    if (!ReadValues(file, hiddenBias.data(), hiddenBias.size()))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < nHidden; ++i)
+    {
+        if (!ReadValues(file, &hiddenWeights[size_t(i) * s_nInputsPadded], nInputs))
+        {
+            return false;
+        }
+    }
+
+    if (!ReadValues(file, outputBias.data(), outputBias.size())
+        || !ReadValues(file, outputWeights.data(), outputWeights.size()))
+    {
+        return false;
+    }
+
+    m_nHidden = static_cast<int>(nHidden);
+    m_hiddenScale = scales[0];
+    m_outputScale = scales[1];
+    m_hiddenBias = move(hiddenBias);
+    m_hiddenWeights = move(hiddenWeights);
+    m_outputBias = move(outputBias);
+    m_outputWeights = move(outputWeights);
+    return true;
+}
+
+bool Network::IsLoaded() const
+{
+    return m_nHidden > 0;
+}
+
+void Network::Evaluate(const uint8_t* inputs, int batchSize, NetworkOutput* outputs) const
+{
+    // Each weight row is applied to the whole batch while it is still in cache
+    vector<uint8_t> hidden(size_t(batchSize) * m_nHidden);
+    for (int neuron = 0; neuron < m_nHidden; ++neuron)
+    {
+        const int8_t* weights = &m_hiddenWeights[size_t(neuron) * s_nInputsPadded];
+        for (int b = 0; b < batchSize; ++b)
+        {
+            const int32_t sum = DotProduct(inputs + size_t(b) * s_nInputsPadded, weights, s_nInputsPadded)
+                + m_hiddenBias[neuron];
+
+            // ReLU, requantized to the unsigned range used by the next layer
+            const float activation = sum * m_hiddenScale;
+            hidden[size_t(b) * m_nHidden + neuron] =
+                static_cast<uint8_t>(min(127.0f, max(0.0f, activation)));
+        }
+    }
+
+    for (int neuron = 0; neuron < s_nOutputs; ++neuron)
+    {
+        const int8_t* weights = &m_outputWeights[size_t(neuron) * m_nHidden];
+        for (int b = 0; b < batchSize; ++b)
+        {
+            const int32_t sum = DotProduct(&hidden[size_t(b) * m_nHidden], weights, m_nHidden)
+                + m_outputBias[neuron];
+
+            const float output = sum * m_outputScale;
+            if (neuron == 0)
+                outputs[b].value = tanh(output);
+            else
+                outputs[b].policy[neuron - 1] = output;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+// BatchEvaluator Implementation
+//------------------------------------------------------------------------
+BatchEvaluator::BatchEvaluator(const Network& network, const BatchConfig& config) :
+    m_network(network),
+    m_config(config),
+    m_stop(false),
+    m_thread(&BatchEvaluator::RunInference, this)
+{}
+
+BatchEvaluator::~BatchEvaluator()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_requestCondition.notify_all();
+    m_thread.join();
+}
+
+NetworkOutput BatchEvaluator::Evaluate(const Position& position)
+{
+    Request request;
+    EncodePosition(position, request.input);
+    request.start = chrono::steady_clock::now();
+
+    unique_lock<mutex> lock(m_mutex);
+    m_pending.push_back(&request);
+    m_requestCondition.notify_one();
+
+    m_doneCondition.wait(lock, [&request]() { return request.isDone; });
+    return request.output;
+}
+
+BatchStats BatchEvaluator::GetStats() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void BatchEvaluator::RunInference()
+{
+    const int maxBatchSize = max(1, m_config.maxBatchSize);
+    vector<Request*> batch;
+    vector<uint8_t> inputs;
+    vector<NetworkOutput> outputs;
+
+    unique_lock<mutex> lock(m_mutex);
+    while (true)
+    {
+        m_requestCondition.wait(lock, [this]() { return m_stop || !m_pending.empty(); });
+        if (m_pending.empty())
+        {
+            break;
+        }
+
+        // Give other search threads a chance to fill up the batch
+        m_requestCondition.wait_for(lock, m_config.maxWait, [this, maxBatchSize]()
+            { return m_stop || static_cast<int>(m_pending.size()) >= maxBatchSize; });
+
+        const size_t batchSize = min(m_pending.size(), size_t(maxBatchSize));
+        batch.assign(m_pending.begin(), m_pending.begin() + batchSize);
+        m_pending.erase(m_pending.begin(), m_pending.begin() + batchSize);
+        lock.unlock();
+
+        inputs.resize(batchSize * s_nInputsPadded);
+        outputs.resize(batchSize);
+        for (size_t i = 0; i < batchSize; ++i)
+        {
+            memcpy(&inputs[i * s_nInputsPadded], batch[i]->input.data(), s_nInputsPadded);
+        }
+        m_network.Evaluate(inputs.data(), static_cast<int>(batchSize), outputs.data());
+
+        const auto end = chrono::steady_clock::now();
+        lock.lock();
+        for (size_t i = 0; i < batchSize; ++i)
+        {
+            batch[i]->output = outputs[i];
+            batch[i]->isDone = true;
+            m_stats.totalLatencyMicros +=
+                chrono::duration<double, micro>(end - batch[i]->start).count();
+        }
+        m_stats.nBatches++;
+        m_stats.nRequests += batchSize;
+        m_doneCondition.notify_all();
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "rules.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Input planes: own men, own kings, opponent men, opponent kings.
+// Boards are always encoded from the point of view of the side to move.
+constexpr int s_nInputPlanes = 4;
+constexpr int s_nInputs = s_nInputPlanes * s_maxSquares;
+
+// Rows are padded so the vectorized dot product never needs a tail loop
+constexpr int s_simdWidth = 32;
+constexpr int s_nInputsPadded = (s_nInputs + s_simdWidth - 1) / s_simdWidth * s_simdWidth;
+
+// One value output followed by a policy logit per (origin square, direction)
+constexpr int s_nPolicyOutputs = s_maxSquares * s_nDirections;
+constexpr int s_nOutputs = 1 + s_nPolicyOutputs;
+
+using NetworkInput = array<uint8_t, s_nInputsPadded>;
+
+struct NetworkOutput
+{
+    // Expected result for the side to move, in [-1, 1]
+    float value = 0.0f;
+    array<float, s_nPolicyOutputs> policy = {};
+};
+
+void EncodePosition(const Position& position, NetworkInput& input);
+int PolicyIndex(const Position& position, const Move& move);
+
+// Two layer int8 MLP: inputs -> ReLU hidden layer -> value and policy outputs
+class Network
+{
+public:
+    Network() :
+        m_nHidden(0),
+        m_hiddenScale(0.0f),
+        m_outputScale(0.0f)
+    {}
+
+    bool Load(const string& path);
+    bool IsLoaded() const;
+
+    // Inputs are laid out contiguously, s_nInputsPadded bytes per position
+    void Evaluate(const uint8_t* inputs, int batchSize, NetworkOutput* outputs) const;
+
+private:
+    int m_nHidden;
+    float m_hiddenScale;
+    float m_outputScale;
+
+    vector<int32_t> m_hiddenBias;
+    vector<int8_t> m_hiddenWeights;
+    vector<int32_t> m_outputBias;
+    vector<int8_t> m_outputWeights;
+};
+
+struct BatchConfig
+{
+    int maxBatchSize = 16;
+
+    // How long a partial batch waits for more requests before it is evaluated
+    chrono::microseconds maxWait = chrono::microseconds(200);
+};
+
+struct BatchStats
+{
+    double AverageBatchSize() const
+    {
+        return nBatches > 0 ? double(nRequests) / nBatches : 0.0;
+    }
+
+    double AverageLatencyMicros() const
+    {
+        return nRequests > 0 ? totalLatencyMicros / nRequests : 0.0;
+    }
+
+    uint64_t nBatches = 0;
+    uint64_t nRequests = 0;
+    double totalLatencyMicros = 0.0;
+};
+
+// Collects leaf evaluations from many search threads and runs them in batches
+// on a dedicated inference thread
+class BatchEvaluator
+{
+public:
+    BatchEvaluator(const Network& network, const BatchConfig& config);
+    ~BatchEvaluator();
+
+    BatchEvaluator(const BatchEvaluator&) = delete;
+    BatchEvaluator& operator=(const BatchEvaluator&) = delete;
+
+    // Blocks the calling thread until its batch has been evaluated
+    NetworkOutput Evaluate(const Position& position);
+
+    BatchStats GetStats() const;
+
+private:
+    struct Request
+    {
+        NetworkInput input;
+        NetworkOutput output;
+        chrono::steady_clock::time_point start;
+        bool isDone = false;
+    };
+
+    void RunInference();
+
+    const Network& m_network;
+    const BatchConfig m_config;
+
+    mutable mutex m_mutex;
+    condition_variable m_requestCondition;
+    condition_variable m_doneCondition;
+    vector<Request*> m_pending;
+    bool m_stop;
+    BatchStats m_stats;
+
+    thread m_thread;
+};
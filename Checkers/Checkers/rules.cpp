@@ -0,0 +1,383 @@
+#include "rules.h"
+#include "movegen.h"
+
+using namespace std;
+
+namespace
+{
+    DiagonalTables BuildDiagonalTables(int size)
+    {
+        DiagonalTables tables;
+        tables.size = size;
+        tables.nSquares = size * size / 2;
+
+        for (int square = 0; square < tables.nSquares; ++square)
+        {
+            const int row = square / (size / 2);
+            const int col = 2 * (square % (size / 2)) + (row % 2 == 0 ? 1 : 0);
+            tables.row[square] = row;
+            tables.col[square] = col;
+        }
+
+        for (int square = 0; square < tables.nSquares; ++square)
+        {
+            for (int dir = 0; dir < s_nDirections; ++dir)
+            {
+                const int row = tables.row[square] + s_rowDelta[dir];
+                const int col = tables.col[square] + s_colDelta[dir];
+                if (row < 0 || row >= size || col < 0 || col >= size)
+                {
+                    tables.neighbour[square][dir] = s_invalidSquare;
+                }
+                else
+                {
+                    tables.neighbour[square][dir] = (row * size + col) / 2;
+                }
+            }
+        }
+
+        return tables;
+    }
+
+    enum PieceKind
+    {
+        OMan,
+        OKing,
+        XMan,
+        XKing,
+        PieceKindCount,
+    };
+
+    struct ZobristKeys
+    {
+        uint64_t pieces[PieceKindCount][s_maxSquares];
+        uint64_t xToMove;
+    };
+
+    uint64_t SplitMix64(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    const ZobristKeys& GetZobristKeys()
+    {
+        // Fixed seed so hashes are stable across runs
+        static const auto s_keys = []()
+        {
+            ZobristKeys keys;
+            uint64_t state = 0x436865636B657273ull;
+            for (auto& kind : keys.pieces)
+            {
+                for (auto& key : kind)
+                {
+                    key = SplitMix64(state);
+                }
+            }
+            keys.xToMove = SplitMix64(state);
+            return keys;
+        }();
+
+        return s_keys;
+    }
+
+    // Reverses the order of the first nSquares bits
+    SquareMask ReverseSquares(SquareMask mask, int nSquares)
+    {
+        mask = ((mask >> 1) & 0x5555555555555555ull) | ((mask & 0x5555555555555555ull) << 1);
+        mask = ((mask >> 2) & 0x3333333333333333ull) | ((mask & 0x3333333333333333ull) << 2);
+        mask = ((mask >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((mask & 0x0F0F0F0F0F0F0F0Full) << 4);
+        mask = ((mask >> 8) & 0x00FF00FF00FF00FFull) | ((mask & 0x00FF00FF00FF00FFull) << 8);
+        mask = ((mask >> 16) & 0x0000FFFF0000FFFFull) | ((mask & 0x0000FFFF0000FFFFull) << 16);
+        mask = (mask >> 32) | (mask << 32);
+        return mask >> (64 - nSquares);
+    }
+}
+
+//------------------------------------------------------------------------
+// Rules core - Board conversion
+//------------------------------------------------------------------------
+bool IsSupportedBoardSize(int size)
+{
+    return size >= 2 && size <= s_maxBoardSize && size % 2 == 0;
+}
+
+const DiagonalTables& GetDiagonalTables(int size)
+{
+    static const auto s_tables = []()
+    {
+        array<DiagonalTables, s_maxBoardSize + 1> tables;
+        for (int size = 2; size <= s_maxBoardSize; size += 2)
+        {
+            tables[size] = BuildDiagonalTables(size);
+        }
+        return tables;
+    }();
+
+    return s_tables[size];
+}
+
+bool PositionFromBoard(const Board& board, PlayerSide sideToMove, RuleVariant variant, Position& position)
+{
+    const int size = static_cast<int>(board.size());
+    if (!IsSupportedBoardSize(size))
+    {
+        return false;
+    }
+
+    Position result;
+    result.size = size;
+    result.sideToMove = sideToMove;
+    result.variant = variant;
+
+    for (int row = 0; row < size; ++row)
+    {
+        if (static_cast<int>(board[row].size()) != size)
+        {
+            return false;
+        }
+
+        for (int col = 0; col < size; ++col)
+        {
+            const char c = board[row][col];
+            const bool isPiece = c == s_oPiece || c == s_oKingPiece
+                || c == s_xPiece || c == s_xKingPiece;
+            if (!isPiece)
+            {
+                continue;
+            }
+
+            // Pieces can only ever stand on dark squares
+            if ((row + col) % 2 == 0)
+            {
+                return false;
+            }
+
+            SetPiece(result, (row * size + col) / 2, c);
+        }
+    }
+
+    position = result;
+    return true;
+}
+
+Board BoardFromPosition(const Position& position)
+{
+    const auto& tables = GetDiagonalTables(position.size);
+    Board board(position.size, string(position.size, ' '));
+
+    for (int square = 0; square < tables.nSquares; ++square)
+    {
+        board[tables.row[square]][tables.col[square]] = GetPiece(position, square);
+    }
+
+    return board;
+}
+
+char GetPiece(const Position& position, int square)
+{
+    const SquareMask bit = SquareBit(square);
+    const bool isKing = (position.kings & bit) != 0;
+
+    if (position.oPieces & bit)
+        return isKing ? s_oKingPiece : s_oPiece;
+    if (position.xPieces & bit)
+        return isKing ? s_xKingPiece : s_xPiece;
+
+    return s_emptyPiece;
+}
+
+void SetPiece(Position& position, int square, char c)
+{
+    const SquareMask bit = SquareBit(square);
+    position.oPieces &= ~bit;
+    position.xPieces &= ~bit;
+    position.kings &= ~bit;
+
+    if (c == s_oPiece || c == s_oKingPiece)
+        position.oPieces |= bit;
+    else if (c == s_xPiece || c == s_xKingPiece)
+        position.xPieces |= bit;
+
+    if (c == s_oKingPiece || c == s_xKingPiece)
+        position.kings |= bit;
+}
+
+PlayerSide GetPieceOwner(char c)
+{
+    if (c == s_oPiece || c == s_oKingPiece)
+        return PlayerSide::OPlayer;
+    if (c == s_xPiece || c == s_xKingPiece)
+        return PlayerSide::XPlayer;
+
+    return PlayerSide::None;
+}
+
+//------------------------------------------------------------------------
+// Rules core - Move generation
+//------------------------------------------------------------------------
+void GenerateMoves(const Position& position, vector<Move>& moves)
+{
+    VisitRules(position.variant, [&](auto rules)
+    {
+        MoveGenerator<decltype(rules)>::Generate(position, moves);
+    });
+}
+
+void ApplyMove(Position& position, const Move& move)
+{
+    const bool isO = position.sideToMove == PlayerSide::OPlayer;
+    SquareMask& own = isO ? position.oPieces : position.xPieces;
+    SquareMask& opponents = isO ? position.xPieces : position.oPieces;
+
+    const SquareMask originBit = SquareBit(move.origin);
+    const SquareMask destBit = SquareBit(move.path[move.nHops - 1]);
+    const bool isKing = (position.kings & originBit) != 0;
+
+    own = (own & ~originBit) | destBit;
+    opponents &= ~move.captured;
+    position.kings &= ~(originBit | move.captured);
+    if (isKing || move.promotes)
+    {
+        position.kings |= destBit;
+    }
+
+    position.sideToMove = isO ? PlayerSide::XPlayer : PlayerSide::OPlayer;
+}
+
+bool HasAnyMove(const Position& position, PlayerSide side)
+{
+    return VisitRules(position.variant, [&](auto rules)
+    {
+        return MoveGenerator<decltype(rules)>::HasAnyMove(position, side);
+    });
+}
+
+bool GetTerminalWinner(const Position& position, PlayerSide& winner)
+{
+    const PlayerSide sides[] = { PlayerSide::OPlayer, PlayerSide::XPlayer };
+
+    // Case 1: One side has no more pieces remaining
+    for (const PlayerSide side : sides)
+    {
+        if (!(side == PlayerSide::OPlayer ? position.oPieces : position.xPieces))
+        {
+            winner = Opponent(side);
+            return true;
+        }
+    }
+
+    // Case 2: No more valid moves, o is checked first
+    for (const PlayerSide side : sides)
+    {
+        if (!HasAnyMove(position, side))
+        {
+            winner = Opponent(side);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t HashPosition(const Position& position)
+{
+    const auto& keys = GetZobristKeys();
+    const SquareMask masks[PieceKindCount] =
+    {
+        position.oPieces & ~position.kings,
+        position.oPieces & position.kings,
+        position.xPieces & ~position.kings,
+        position.xPieces & position.kings,
+    };
+
+    uint64_t hash = position.sideToMove == PlayerSide::XPlayer ? keys.xToMove : 0;
+    for (int kind = 0; kind < PieceKindCount; ++kind)
+    {
+        SquareMask pieces = masks[kind];
+        while (pieces)
+        {
+            hash ^= keys.pieces[kind][PopLowestSquare(pieces)];
+        }
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------
+// Rules core - Colour symmetry
+//------------------------------------------------------------------------
+int MirrorSquare(int size, int square)
+{
+    return size * size / 2 - 1 - square;
+}
+
+Position MirrorPosition(const Position& position)
+{
+    const int nSquares = position.size * position.size / 2;
+
+    Position mirrored = position;
+    mirrored.oPieces = ReverseSquares(position.xPieces, nSquares);
+    mirrored.xPieces = ReverseSquares(position.oPieces, nSquares);
+    mirrored.kings = ReverseSquares(position.kings, nSquares);
+    mirrored.sideToMove = Opponent(position.sideToMove);
+    return mirrored;
+}
+
+Move MirrorMove(int size, const Move& move)
+{
+    Move mirrored = move;
+    mirrored.origin = MirrorSquare(size, move.origin);
+    for (int i = 0; i < move.nHops; ++i)
+    {
+        mirrored.path[i] = MirrorSquare(size, move.path[i]);
+    }
+    mirrored.captured = ReverseSquares(move.captured, size * size / 2);
+    return mirrored;
+}
+
+bool CanonicalPosition(const Position& position, Position& canonical)
+{
+    if (position.sideToMove == PlayerSide::OPlayer)
+    {
+        canonical = position;
+        return false;
+    }
+
+    canonical = MirrorPosition(position);
+    return true;
+}
+
+uint64_t CanonicalHash(const Position& position)
+{
+    Position canonical;
+    CanonicalPosition(position, canonical);
+    return HashPosition(canonical);
+}
+
+//------------------------------------------------------------------------
+// Rules core - Notation
+//------------------------------------------------------------------------
+string SquareName(int size, int square)
+{
+    const auto& tables = GetDiagonalTables(size);
+
+    string name;
+    name += char('a' + tables.col[square]);
+    name += to_string(size - tables.row[square]);
+    return name;
+}
+
+vector<string> MoveToInputs(int size, const Move& move)
+{
+    vector<string> inputs;
+    inputs.push_back(SquareName(size, move.origin));
+    for (int i = 0; i < move.nHops; ++i)
+    {
+        inputs.push_back(SquareName(size, move.path[i]));
+    }
+
+    return inputs;
+}
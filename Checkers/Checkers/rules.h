@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+using Board = vector<string>;
+
+constexpr auto s_oPiece = 'o';
+constexpr auto s_oKingPiece = 'O';
+constexpr auto s_xPiece = 'x';
+constexpr auto s_xKingPiece = 'X';
+
+constexpr auto s_emptyPiece = '.';
+
+// A game is drawn after this many plies without a capture or a regular piece
+// moving, or once the same position has been repeated s_drawRepetitions times
+constexpr int s_defaultDrawPlyLimit = 80;
+constexpr int s_drawRepetitions = 3;
+
+enum class PlayerSide
+{
+    OPlayer,
+    XPlayer,
+
+    // Winner of a drawn game
+    None,
+};
+
+inline PlayerSide Opponent(PlayerSide side)
+{
+    switch (side)
+    {
+        case PlayerSide::OPlayer:
+            return PlayerSide::XPlayer;
+        case PlayerSide::XPlayer:
+            return PlayerSide::OPlayer;
+        case PlayerSide::None:
+            break;
+    }
+
+    return PlayerSide::None;
+}
+
+// Rules the move generator can play, see movegen.h
+enum class RuleVariant : uint8_t
+{
+    Standard,
+
+    // International draughts: flying kings, regular pieces capture backwards
+    International,
+};
+
+// The compact rules core only stores the playable (dark) squares,
+// so a 10 x 10 board fits into a single 64-bit mask per piece type
+constexpr int s_maxBoardSize = 10;
+constexpr int s_maxSquares = s_maxBoardSize * s_maxBoardSize / 2;
+
+// Longest capture chain we generate for a single turn
+constexpr int s_maxHops = 12;
+
+constexpr int s_nDirections = 4;
+constexpr int s_invalidSquare = -1;
+
+using SquareMask = uint64_t;
+
+inline SquareMask SquareBit(int square)
+{
+    return SquareMask(1) << square;
+}
+
+// Trivially copyable position used by search and validation code
+struct Position
+{
+    SquareMask oPieces = 0;
+    SquareMask xPieces = 0;
+    SquareMask kings = 0;
+    int8_t size = 0;
+    PlayerSide sideToMove = PlayerSide::OPlayer;
+    RuleVariant variant = RuleVariant::Standard;
+};
+
+inline bool operator==(const Position& a, const Position& b)
+{
+    return a.oPieces == b.oPieces
+        && a.xPieces == b.xPieces
+        && a.kings == b.kings
+        && a.size == b.size
+        && a.sideToMove == b.sideToMove
+        && a.variant == b.variant;
+}
+
+// A full turn: the origin square followed by every square the piece lands on
+struct Move
+{
+    int8_t origin = s_invalidSquare;
+    int8_t nHops = 0;
+    bool promotes = false;
+    array<int8_t, s_maxHops> path = {};
+    SquareMask captured = 0;
+};
+
+// Same origin and landing squares, the rest follows from the position
+inline bool IsSameMove(const Move& a, const Move& b)
+{
+    return a.origin == b.origin
+        && a.nHops == b.nHops
+        && equal(a.path.begin(), a.path.begin() + a.nHops, b.path.begin());
+}
+
+// Precomputed diagonal neighbours of every playable square
+struct DiagonalTables
+{
+    int size = 0;
+    int nSquares = 0;
+    int8_t row[s_maxSquares] = {};
+    int8_t col[s_maxSquares] = {};
+    int8_t neighbour[s_maxSquares][s_nDirections] = {};
+};
+
+// Even sizes from 2 up to s_maxBoardSize, the only ones with diagonal tables
+bool IsSupportedBoardSize(int size);
+const DiagonalTables& GetDiagonalTables(int size);
+
+bool PositionFromBoard(const Board& board, PlayerSide sideToMove, RuleVariant variant, Position& position);
+Board BoardFromPosition(const Position& position);
+
+// Board symbol of a single square, and the reverse
+char GetPiece(const Position& position, int square);
+void SetPiece(Position& position, int square, char c);
+
+// Side a board symbol belongs to, None for anything but a piece
+PlayerSide GetPieceOwner(char c);
+
+// Generates every turn the current player may input, including each
+// intermediate stop of a capture chain, under the rules of position.variant
+void GenerateMoves(const Position& position, vector<Move>& moves);
+void ApplyMove(Position& position, const Move& move);
+bool HasAnyMove(const Position& position, PlayerSide side);
+
+// Captures and regular piece moves can never be undone
+inline bool IsIrreversible(const Position& position, const Move& move)
+{
+    return move.captured != 0 || !(position.kings & SquareBit(move.origin));
+}
+
+// Zobrist hash of the pieces and the side to move
+uint64_t HashPosition(const Position& position);
+
+// Swapping the colours and rotating the board 180 degrees gives an equivalent
+// position with the other side to move. The rotation reverses the order of
+// the playable squares. The canonical form of a position is the one with o to
+// move, stored data and the move generator only ever deal with that form.
+int MirrorSquare(int size, int square);
+Position MirrorPosition(const Position& position);
+Move MirrorMove(int size, const Move& move);
+
+// Returns true if the position had to be mirrored
+bool CanonicalPosition(const Position& position, Position& canonical);
+
+// Equal for a position and its mirror image
+uint64_t CanonicalHash(const Position& position);
+
+// Returns true if one side has no pieces or no moves left, used by
+// Game::CheckWinCondition
+bool GetTerminalWinner(const Position& position, PlayerSide& winner);
+
+string SquareName(int size, int square);
+vector<string> MoveToInputs(int size, const Move& move);
@@ -0,0 +1,292 @@
+#include "validator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+    // Games are handed out to the worker threads in chunks of this size
+    constexpr size_t s_chunkSize = 256;
+
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    string_view Trim(string_view text)
+    {
+        while (!text.empty() && IsSpace(text.front()))
+            text.remove_prefix(1);
+        while (!text.empty() && IsSpace(text.back()))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    // Parses "a3 b4 c5" into squares, returns false on malformed input
+    bool ParseTurn(string_view turn, int size, int* squares, int& nSquares, bool& isOnBoard)
+    {
+        nSquares = 0;
+        isOnBoard = true;
+
+        size_t i = 0;
+        while (i < turn.size())
+        {
+            if (IsSpace(turn[i]))
+            {
+                ++i;
+                continue;
+            }
+
+            if (turn[i] < 'a' || turn[i] > 'z' || nSquares > s_maxHops)
+                return false;
+
+            const int col = turn[i++] - 'a';
+            int number = 0;
+            size_t nDigits = 0;
+            while (i < turn.size() && turn[i] >= '0' && turn[i] <= '9')
+            {
+                number = number * 10 + (turn[i++] - '0');
+                if (++nDigits > 2)
+                    return false;
+            }
+
+            if (nDigits == 0 || (i < turn.size() && !IsSpace(turn[i])))
+                return false;
+
+            // Squares that don't exist or can't hold a piece are legal notation
+            // but never part of a legal move
+            const int row = size - number;
+            if (row < 0 || row >= size || col >= size || (row + col) % 2 == 0)
+            {
+                isOnBoard = false;
+            }
+            else
+            {
+                squares[nSquares] = (row * size + col) / 2;
+            }
+            nSquares++;
+        }
+
+        return nSquares >= 2;
+    }
+
+    bool MatchesMove(const Move& move, const int* squares, int nSquares)
+    {
+        if (move.origin != squares[0] || move.nHops != nSquares - 1)
+            return false;
+
+        for (int i = 1; i < nSquares; ++i)
+        {
+            if (move.path[i - 1] != squares[i])
+                return false;
+        }
+
+        return true;
+    }
+}
+
+const char* GetValidationErrorName(ValidationError error)
+{
+    switch (error)
+    {
+        case ValidationError::None:
+            return "ok";
+        case ValidationError::BadFormat:
+            return "bad format";
+        case ValidationError::IllegalMove:
+            return "illegal move";
+        case ValidationError::GameOver:
+            return "move after game over";
+    }
+
+    return "unknown";
+}
+
+//------------------------------------------------------------------------
+// BatchValidator Implementation - Public API
+//------------------------------------------------------------------------
+void BatchValidator::SetDrawPlyLimit(int nPlies)
+{
+    m_drawPlyLimit = nPlies;
+}
+
+bool BatchValidator::ValidateFile(const string& path, ValidationReport& report) const
+{
+    ifstream file(path, ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    // One read for the whole archive, games are then referenced in place
+    stringstream buffer;
+    buffer << file.rdbuf();
+    report = Validate(buffer.str());
+    return true;
+}
+
+ValidationReport BatchValidator::Validate(const string& archive) const
+{
+    const auto start = chrono::steady_clock::now();
+
+    vector<GameLine> games;
+    size_t lineStart = 0;
+    size_t lineNumber = 0;
+    while (lineStart < archive.size())
+    {
+        size_t lineEnd = archive.find('\n', lineStart);
+        if (lineEnd == string::npos)
+            lineEnd = archive.size();
+
+        lineNumber++;
+        const string_view text = Trim(string_view(archive).substr(lineStart, lineEnd - lineStart));
+        if (!text.empty() && text.front() != '#')
+        {
+            games.push_back({ lineNumber, text });
+        }
+
+        lineStart = lineEnd + 1;
+    }
+
+    // Every game owns its result slot, so workers never need to synchronize
+    vector<ValidationResult> results(games.size());
+    vector<size_t> nTurns(m_nThreads, 0);
+    atomic<size_t> nextChunk(0);
+
+    auto runWorker = [&](int index)
+    {
+        vector<Move> moves;
+        moves.reserve(64);
+
+        size_t first;
+        while ((first = nextChunk.fetch_add(s_chunkSize)) < games.size())
+        {
+            const size_t last = min(first + s_chunkSize, games.size());
+            for (size_t i = first; i < last; ++i)
+            {
+                ValidateGame(games[i], results[i], nTurns[index], moves);
+            }
+        }
+    };
+
+    const int nThreads = static_cast<int>(min<size_t>(m_nThreads, games.size() / s_chunkSize + 1));
+    vector<thread> workers;
+    for (int i = 1; i < nThreads; ++i)
+    {
+        workers.emplace_back(runWorker, i);
+    }
+    runWorker(0);
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    ValidationReport report;
+    report.nGames = games.size();
+    for (size_t count : nTurns)
+    {
+        report.nTurns += count;
+    }
+
+    for (auto& result : results)
+    {
+        if (result.error != ValidationError::None)
+        {
+            report.rejected.push_back(move(result));
+        }
+    }
+
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+//------------------------------------------------------------------------
+// BatchValidator Implementation - Private API
+//------------------------------------------------------------------------
+void BatchValidator::ValidateGame(const GameLine& game, ValidationResult& result, size_t& nTurns, vector<Move>& moves) const
+{
+    result.line = game.line;
+
+    Position position = m_start;
+    int nQuietPlies = 0;
+    vector<uint64_t> history = { HashPosition(position) };
+    bool isOver = false;
+
+    int ply = 0;
+    size_t turnStart = 0;
+    while (turnStart <= game.text.size())
+    {
+        size_t turnEnd = game.text.find(',', turnStart);
+        if (turnEnd == string_view::npos)
+            turnEnd = game.text.size();
+
+        const string_view turn = Trim(game.text.substr(turnStart, turnEnd - turnStart));
+        turnStart = turnEnd + 1;
+        ply++;
+        nTurns++;
+
+        int squares[s_maxHops + 1];
+        int nSquares;
+        bool isOnBoard;
+        ValidationError error = ValidationError::None;
+        const Move* played = nullptr;
+
+        if (!ParseTurn(turn, position.size, squares, nSquares, isOnBoard))
+        {
+            error = ValidationError::BadFormat;
+        }
+        else if (isOver)
+        {
+            error = ValidationError::GameOver;
+        }
+        else if (isOnBoard)
+        {
+            GenerateMoves(position, moves);
+            const auto it = find_if(moves.begin(), moves.end(), [&](const Move& move)
+                { return MatchesMove(move, squares, nSquares); });
+            if (it != moves.end())
+            {
+                played = &*it;
+            }
+        }
+
+        if (error == ValidationError::None && !played)
+        {
+            error = ValidationError::IllegalMove;
+        }
+
+        if (error != ValidationError::None)
+        {
+            result.error = error;
+            result.ply = ply;
+            result.turn = string(turn);
+            return;
+        }
+
+        // Same end of game rules as Game::CheckWinCondition
+        if (IsIrreversible(position, *played))
+        {
+            nQuietPlies = 0;
+            history.clear();
+        }
+        else
+        {
+            nQuietPlies++;
+        }
+
+        ApplyMove(position, *played);
+        history.push_back(HashPosition(position));
+
+        PlayerSide winner;
+        isOver = GetTerminalWinner(position, winner)
+            || (m_drawPlyLimit > 0 && nQuietPlies >= m_drawPlyLimit)
+            || count(history.begin(), history.end(), history.back()) >= s_drawRepetitions;
+    }
+}
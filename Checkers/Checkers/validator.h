@@ -0,0 +1,67 @@
+#pragma once
+
+#include "rules.h"
+
+#include <string_view>
+
+// Archives hold one game per line, turns are separated by commas and use the
+// same notation as the interactive prompt, e.g. "a3 b4, b6 a5, b4 c5 d6".
+// Empty lines and lines starting with '#' are skipped.
+enum class ValidationError
+{
+    None,
+    BadFormat,
+    IllegalMove,
+    GameOver,
+};
+
+struct ValidationResult
+{
+    size_t line = 0;
+    ValidationError error = ValidationError::None;
+
+    // First rejected turn, 1-based
+    int ply = 0;
+    string turn;
+};
+
+struct ValidationReport
+{
+    size_t nGames = 0;
+    size_t nTurns = 0;
+    double seconds = 0.0;
+
+    // Only games with an illegal turn, in archive order
+    vector<ValidationResult> rejected;
+};
+
+const char* GetValidationErrorName(ValidationError error);
+
+// Replays archived games against the move generator on a pool of threads
+class BatchValidator
+{
+public:
+    BatchValidator(const Position& start, int nThreads) :
+        m_start(start),
+        m_nThreads(nThreads > 0 ? nThreads : 1),
+        m_drawPlyLimit(s_defaultDrawPlyLimit)
+    {}
+
+    void SetDrawPlyLimit(int nPlies);
+
+    bool ValidateFile(const string& path, ValidationReport& report) const;
+    ValidationReport Validate(const string& archive) const;
+
+private:
+    struct GameLine
+    {
+        size_t line;
+        string_view text;
+    };
+
+    void ValidateGame(const GameLine& game, ValidationResult& result, size_t& nTurns, vector<Move>& moves) const;
+
+    const Position m_start;
+    const int m_nThreads;
+    int m_drawPlyLimit;
+};